@@ -0,0 +1,309 @@
+#include <functional>
+
+#include <QApplication>
+#include <QColor>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QPushButton>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <QMWidgets/qmdecoratorv2.h>
+
+// The sizes can be changed with the environment variables:
+//     QM_BENCH_PACKAGES, QM_BENCH_NAMESPACES, QM_BENCH_VARIABLES, QM_BENCH_WIDGETS
+static int benchParameter(const char *name, int defaultValue) {
+    bool ok;
+    int value = qEnvironmentVariableIntValue(name, &ok);
+    return ok && value > 0 ? value : defaultValue;
+}
+
+static const char *const themeNames[] = {"Light", "Dark"};
+
+// A refresh that takes longer is considered lost
+static const int RefreshTimeout = 30000;
+
+class bench_Theme : public QObject {
+    Q_OBJECT
+public:
+    bench_Theme();
+
+private:
+    int packageCount;
+    int namespaceCount;
+    int variableCount;
+    int widgetCount;
+
+    QTemporaryDir dir;
+    QScopedPointer<QWidget> window;
+    QScopedPointer<QMDecoratorV2> decorator;
+
+    // The test functions run several times to get stable results, the statistics of the last
+    // run are reported when all of them finish
+    QMap<QString, QMDecoratorV2::RefreshStatistics> refreshStats;
+    QMDecoratorV2::ScanStatistics scanStats;
+
+    bool writePackages();
+    void populate(QWidget *parent, int count, int offset);
+    static bool waitForRefresh(QMDecoratorV2 *dec, const std::function<void()> &func);
+    void report();
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void setTheme();
+    void setZoomRatio();
+    void setFontRatio();
+    void installTheme();
+
+    // Runs last, the temporary decorators reset the global instance
+    void scanForThemes();
+};
+
+bench_Theme::bench_Theme() {
+    packageCount = benchParameter("QM_BENCH_PACKAGES", 4);
+    namespaceCount = benchParameter("QM_BENCH_NAMESPACES", 32);
+    variableCount = benchParameter("QM_BENCH_VARIABLES", 64);
+    widgetCount = benchParameter("QM_BENCH_WIDGETS", 1000);
+}
+
+// Every package defines the variables of both themes and a style sheet file for each namespace,
+// the namespaces of all packages are mapped to the same widget ids.
+bool bench_Theme::writePackages() {
+    for (int i = 0; i < packageCount; ++i) {
+        const QString packageDir = dir.filePath(QStringLiteral("package%1").arg(i));
+        if (!QDir().mkpath(packageDir)) {
+            return false;
+        }
+
+        QJsonObject variables;
+        QJsonObject stylesheets;
+        for (int t = 0; t < 2; ++t) {
+            const QString theme = QString::fromLatin1(themeNames[t]);
+
+            QJsonObject themeVariables;
+            for (int k = 0; k < variableCount; ++k) {
+                const auto &color =
+                    QColor::fromHsv((k * 37 + i * 11) % 360, 120 + t * 100, 220 - t * 160);
+                themeVariables.insert(QStringLiteral("color%1").arg(k), color.name());
+            }
+            variables.insert(theme, themeVariables);
+
+            QJsonObject themeStylesheets;
+            for (int j = 0; j < namespaceCount; ++j) {
+                const QString ns = QStringLiteral("p%1n%2").arg(i).arg(j);
+                const QString fileName = QStringLiteral("%1-%2.qss").arg(theme, ns);
+
+                QString content;
+                for (int r = 0; r < 4; ++r) {
+                    const int k = (j * 4 + r) % variableCount;
+                    content += QStringLiteral(
+                                   "/* rule %1 */\n"
+                                   "QPushButton[ns=\"%2\"][rule=\"%1\"] {\n"
+                                   "    color: ${color%3};\n"
+                                   "    background-color: ${color%4};\n"
+                                   "    border: 1px solid ${color%5};\n"
+                                   "    border-radius: 4px;\n"
+                                   "    padding: 2px 8px;\n"
+                                   "    font-size: 12px;\n"
+                                   "    --iconSize: 16px 16px;\n"
+                                   "}\n\n"
+                                   "QPushButton[ns=\"%2\"][rule=\"%1\"]:not(:enabled) {\n"
+                                   "    color: ${color%4};\n"
+                                   "}\n\n")
+                                   .arg(r)
+                                   .arg(ns)
+                                   .arg(k)
+                                   .arg((k + 1) % variableCount)
+                                   .arg((k + 2) % variableCount);
+                }
+
+                QFile file(QDir(packageDir).filePath(fileName));
+                if (!file.open(QIODevice::WriteOnly)) {
+                    return false;
+                }
+                file.write(content.toUtf8());
+
+                themeStylesheets.insert(ns, QJsonObject{{QStringLiteral("file"), fileName}});
+            }
+            stylesheets.insert(theme, themeStylesheets);
+        }
+
+        QJsonObject widgets;
+        for (int j = 0; j < namespaceCount; ++j) {
+            widgets.insert(QStringLiteral("Widget%1").arg(j),
+                           QJsonArray{QStringLiteral("p%1n%2").arg(i).arg(j)});
+        }
+
+        QJsonObject root;
+        root.insert(QStringLiteral("config"), QJsonObject{{QStringLiteral("priority"), i + 1}});
+        root.insert(QStringLiteral("variables"), variables);
+        root.insert(QStringLiteral("widgets"), widgets);
+        root.insert(QStringLiteral("stylesheets"), stylesheets);
+
+        QFile file(QDir(packageDir).filePath(QStringLiteral("package.res.json")));
+        if (!file.open(QIODevice::WriteOnly)) {
+            return false;
+        }
+        file.write(QJsonDocument(root).toJson());
+    }
+    return true;
+}
+
+void bench_Theme::populate(QWidget *parent, int count, int offset) {
+    for (int i = 0; i < count; ++i) {
+        auto button = new QPushButton(QStringLiteral("Button"), parent);
+        button->setProperty("ns", QStringLiteral("p0n%1").arg((offset + i) % namespaceCount));
+        button->setProperty("rule", QString::number(i % 4));
+        button->move((i % 40) * 24, (i / 40) % 40 * 24);
+        decorator->installTheme(button,
+                                QStringLiteral("Widget%1").arg((offset + i) % namespaceCount));
+    }
+}
+
+// The visible subscribers are restyled in several event loop iterations, returns false if the
+// refresh doesn't finish in time
+bool bench_Theme::waitForRefresh(QMDecoratorV2 *dec, const std::function<void()> &func) {
+    bool changed = false;
+    auto conn = connect(dec, &QMDecoratorV2::themeChanged, [&changed]() { changed = true; });
+    func();
+
+    QDeadlineTimer deadline(RefreshTimeout);
+    while (!changed && !deadline.hasExpired()) {
+        QCoreApplication::processEvents();
+    }
+    disconnect(conn);
+    return changed;
+}
+
+void bench_Theme::report() {
+    refreshStats.insert(QString::fromLatin1(QTest::currentTestFunction()),
+                        decorator->lastRefreshStatistics());
+}
+
+void bench_Theme::initTestCase() {
+    QVERIFY(dir.isValid());
+    QVERIFY(writePackages());
+
+    decorator.reset(new QMDecoratorV2());
+    decorator->addThemePath(dir.path());
+
+    window.reset(new QWidget());
+    window->resize(960, 960);
+    populate(window.data(), widgetCount, 0);
+    window->show();
+    window->activateWindow();
+    QVERIFY(QTest::qWaitForWindowExposed(window.data()));
+
+    QVERIFY(waitForRefresh(decorator.data(), [this]() {
+        decorator->setTheme(QString::fromLatin1(themeNames[0]));
+    }));
+}
+
+void bench_Theme::cleanupTestCase() {
+    window.reset();
+    decorator.reset();
+
+    qDebug().nospace() << packageCount << " packages, " << namespaceCount << " namespaces, "
+                       << variableCount << " variables, " << widgetCount << " widgets";
+    for (auto it = refreshStats.cbegin(); it != refreshStats.cend(); ++it) {
+        const auto &stats = it.value();
+        qDebug().nospace() << it.key() << ": " << stats.restyledCount << " restyled, "
+                           << stats.unchangedCount << " unchanged, " << stats.formatCount
+                           << " formats, " << stats.sliceCount << " slices, evaluate "
+                           << stats.evaluateTime << "us, apply " << stats.applyTime << "us";
+    }
+    qDebug().nospace() << "scanForThemes: " << scanStats.fileCount << " files, "
+                       << scanStats.styleSheetCount << " style sheets, " << scanStats.bytesRead
+                       << " bytes";
+}
+
+void bench_Theme::setTheme() {
+    int i = 0;
+    QBENCHMARK {
+        QVERIFY(waitForRefresh(decorator.data(), [&]() {
+            decorator->setTheme(QString::fromLatin1(themeNames[++i % 2]));
+        }));
+    }
+    report();
+
+    if (i % 2) {
+        QVERIFY(waitForRefresh(decorator.data(), [this]() {
+            decorator->setTheme(QString::fromLatin1(themeNames[0]));
+        }));
+    }
+}
+
+void bench_Theme::setZoomRatio() {
+    int i = 0;
+    QBENCHMARK {
+        QVERIFY(waitForRefresh(decorator.data(),
+                               [&]() { decorator->setZoomRatio(++i % 2 ? 1.25 : 1); }));
+    }
+    report();
+
+    if (decorator->zoomRatio() != 1) {
+        QVERIFY(waitForRefresh(decorator.data(), [this]() { decorator->setZoomRatio(1); }));
+    }
+}
+
+void bench_Theme::setFontRatio() {
+    int i = 0;
+    QBENCHMARK {
+        QVERIFY(waitForRefresh(decorator.data(),
+                               [&]() { decorator->setFontRatio(++i % 2 ? 1.25 : 1); }));
+    }
+    report();
+
+    if (decorator->fontRatio() != 1) {
+        QVERIFY(waitForRefresh(decorator.data(), [this]() { decorator->setFontRatio(1); }));
+    }
+}
+
+void bench_Theme::installTheme() {
+    // The style sheets are applied when the widgets are shown
+    QBENCHMARK {
+        QWidget container(window.data());
+        populate(&container, widgetCount, 1);
+        container.show();
+        QCoreApplication::processEvents();
+    }
+}
+
+void bench_Theme::scanForThemes() {
+    // Without the compiled cache. The style sheets are read when a theme is used for the first
+    // time, so a subscriber is restyled to load the first theme as an application starts.
+    QBENCHMARK {
+        QMDecoratorV2 dec;
+        dec.addThemePath(dir.path());
+        QCOMPARE(dec.themes().size(), 2);
+
+        QPushButton button(QStringLiteral("Button"), window.data());
+        dec.installTheme(&button, QStringLiteral("Widget0"));
+        button.show();
+        QVERIFY(waitForRefresh(&dec, [&dec]() {
+            dec.setTheme(QString::fromLatin1(themeNames[0]));
+        }));
+        scanStats = dec.lastScanStatistics();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    // Run headless unless a platform is specified
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+    bench_Theme tc;
+    return QTest::qExec(&tc, argc, argv);
+}
+
+#include "bench_theme.moc"
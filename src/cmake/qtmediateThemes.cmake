@@ -0,0 +1,55 @@
+# Precompiles a theme directory at build time, the output is loaded by QMDecoratorV2 instead of
+# the theme files when it's placed in the theme directory as themes.qmtc and the theme files are
+# unchanged or not shipped. The output only holds relative paths and content hashes, so it stays
+# valid wherever the themes are installed.
+#
+# The qmthemec tool of this build tree or of the installed package is used, set
+# QTMEDIATE_THEMEC_EXECUTABLE to use a host tool when cross compiling.
+#
+#   qtmediate_compile_themes(<target> <dir> [OUTPUT <file>] [INSTALL_DIR <dir>])
+#
+function(qtmediate_compile_themes _target _dir)
+    set(options)
+    set(oneValueArgs OUTPUT INSTALL_DIR)
+    set(multiValueArgs)
+    cmake_parse_arguments(FUNC "${options}" "${oneValueArgs}" "${multiValueArgs}" ${ARGN})
+
+    get_filename_component(_dir ${_dir} ABSOLUTE)
+
+    if(FUNC_OUTPUT)
+        get_filename_component(_output ${FUNC_OUTPUT} ABSOLUTE
+            BASE_DIR ${CMAKE_CURRENT_BINARY_DIR}
+        )
+    else()
+        set(_output ${CMAKE_CURRENT_BINARY_DIR}/${_target}/themes.qmtc)
+    endif()
+
+    if(QTMEDIATE_THEMEC_EXECUTABLE)
+        set(_tool ${QTMEDIATE_THEMEC_EXECUTABLE})
+        set(_tool_depends)
+    elseif(TARGET qmthemec)
+        set(_tool $<TARGET_FILE:qmthemec>)
+        set(_tool_depends qmthemec)
+    elseif(TARGET qtmediate::qmthemec)
+        set(_tool $<TARGET_FILE:qtmediate::qmthemec>)
+        set(_tool_depends qtmediate::qmthemec)
+    else()
+        message(FATAL_ERROR "qtmediate_compile_themes: qmthemec not found, enable "
+            "QTMEDIATE_BUILD_TOOLS or set QTMEDIATE_THEMEC_EXECUTABLE")
+    endif()
+
+    file(GLOB_RECURSE _sources CONFIGURE_DEPENDS ${_dir}/*)
+    list(FILTER _sources EXCLUDE REGEX "/themes\\.qmtc$")
+
+    add_custom_command(OUTPUT ${_output}
+        COMMAND ${_tool} ${_dir} ${_output}
+        DEPENDS ${_sources} ${_tool_depends}
+        COMMENT "Compiling themes in ${_dir}"
+        VERBATIM
+    )
+    add_custom_target(${_target} ALL DEPENDS ${_output})
+
+    if(FUNC_INSTALL_DIR)
+        install(FILES ${_output} DESTINATION ${FUNC_INSTALL_DIR})
+    endif()
+endfunction()
@@ -0,0 +1,73 @@
+#ifndef QMCONCURRENT_P_H
+#define QMCONCURRENT_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+#include <QMCore/qmglobal.h>
+
+namespace QMPrivate {
+
+    // Calls func(i) for every i in [0, count) on the global thread pool, the calling thread takes
+    // part in the work and the function returns after all calls finish.
+    //
+    // The workers are only started on idle threads of the pool, so the caller never waits for
+    // the other jobs queued on the pool, and it's safe to call from a pool thread. The caller
+    // waits for the calls that are running rather than for the workers to start.
+    template <class Func>
+    void parallelFor(int count, const Func &func) {
+        if (count <= 0) {
+            return;
+        }
+
+        auto pool = QThreadPool::globalInstance();
+        int workers = qMin(pool->maxThreadCount(), count) - 1;
+        if (workers <= 0) {
+            for (int i = 0; i < count; ++i) {
+                func(i);
+            }
+            return;
+        }
+
+        // Shared with the workers, which may still hold it after the function returns
+        struct State {
+            QAtomicInt next;
+            QAtomicInt done;
+            QSemaphore finished;
+        };
+        auto state = QSharedPointer<State>::create();
+
+        // The function is only called for the indices taken before all calls finish
+        const Func *f = &func;
+        auto work = [state, f, count]() {
+            int i;
+            while ((i = state->next.fetchAndAddRelaxed(1)) < count) {
+                (*f)(i);
+                if (state->done.fetchAndAddOrdered(1) + 1 == count) {
+                    state->finished.release();
+                }
+            }
+        };
+        for (int i = 0; i < workers; ++i) {
+            if (!pool->tryStart(work)) {
+                break;
+            }
+        }
+        work();
+        state->finished.acquire();
+    }
+
+}
+
+#endif // QMCONCURRENT_P_H
@@ -2,12 +2,14 @@
 #include "qmcoreappextension_p.h"
 
 #include <QCoreApplication>
+#include <QHash>
 #include <QIODevice>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonParseError>
 #include <QMessageLogger>
+#include <QMutex>
 #include <QSettings>
 #include <QStandardPaths>
 
@@ -39,6 +41,37 @@ Q_LOGGING_CATEGORY(qAppExtLog, "qtmediate")
 
 static QMCoreAppExtension *m_instance = nullptr;
 
+namespace {
+
+    // Results of QMCoreAppExtension::translate(), cleared when the translators of the
+    // application change
+    struct TranslationCache {
+        QMutex lock;
+        bool enabled = false; // While the application extension exists
+        quint64 generation = 0;
+        QList<QTranslator *> translators; // Shares the list of the application while unchanged
+        QHash<QByteArray, QPair<QString, bool>> results; // [ context, source, comment, n ]
+    };
+
+}
+
+Q_GLOBAL_STATIC(TranslationCache, translationCache)
+
+// The results are dropped when there are too many
+static const int MaxTranslationCacheSize = 16384;
+
+static void setTranslationCacheEnabled(bool enabled) {
+    if (translationCache.isDestroyed()) {
+        return;
+    }
+    auto cache = translationCache();
+    QMutexLocker locker(&cache->lock);
+    cache->enabled = enabled;
+    cache->generation++;
+    cache->translators.clear();
+    cache->results.clear();
+}
+
 static QString appUpperDir() {
     static QString dir = QDir::cleanPath(QCoreApplication::applicationDirPath() + "/..");
     return dir;
@@ -49,6 +82,7 @@ QMCoreAppExtensionPrivate::QMCoreAppExtensionPrivate() {
 }
 
 QMCoreAppExtensionPrivate::~QMCoreAppExtensionPrivate() {
+    setTranslationCacheEnabled(false);
 }
 
 void QMCoreAppExtensionPrivate::init() {
@@ -88,6 +122,8 @@ void QMCoreAppExtensionPrivate::init() {
     QObject::connect(qApp, &QCoreApplication::aboutToQuit, this,
                      &QMCoreAppExtensionPrivate::_q_applicationAboutToQuit);
 
+    setTranslationCacheEnabled(true);
+
     // Add plugin paths
     for (const auto &path : qAsConst(pluginPaths))
         QCoreApplication::addLibraryPath(path);
@@ -590,8 +626,28 @@ static void replacePercentN(QString *result, int n) {
     }
 }
 
+/*!
+    Drops the cached results of translate(), the lookups in progress don't store their results.
+*/
+void QMCoreAppExtension::clearTranslationCache() {
+    if (translationCache.isDestroyed()) {
+        return;
+    }
+    auto cache = translationCache();
+    QMutexLocker locker(&cache->lock);
+    cache->generation++;
+    cache->results.clear();
+}
+
 /*!
     Returns the translation text for /a sourceText, along with the success flag.
+
+    While the application extension exists, the results are cached until a translator is
+    installed in or removed from the application, so the repeated lookups don't need to go
+    through the translators. Call clearTranslationCache() after reloading an installed
+    translator.
+
+    \sa clearTranslationCache()
  */
 QString QMCoreAppExtension::translate(const char *context, const char *sourceText,
                                       const char *disambiguation, int n, bool *ok) {
@@ -611,27 +667,73 @@ QString QMCoreAppExtension::translate(const char *context, const char *sourceTex
     };
 
     auto self = QCoreApplication::instance();
-    if (self) {
-        QCoreApplicationPrivate *d = static_cast<HackedApplication *>(self)->d_func();
-        QReadLocker locker(&d->translateMutex);
-        if (!d->translators.isEmpty()) {
-            QList<QTranslator *>::ConstIterator it;
-            QTranslator *translationFile;
-            for (it = d->translators.constBegin(); it != d->translators.constEnd(); ++it) {
-                translationFile = *it;
-                result = translationFile->translate(context, sourceText, disambiguation, n);
-                if (!result.isNull())
-                    break;
+    if (!self) {
+        result = QString::fromUtf8(sourceText);
+        replacePercentN(&result, n);
+        return result;
+    }
+
+    // The translators can't change until the lookup is done
+    QCoreApplicationPrivate *d = static_cast<HackedApplication *>(self)->d_func();
+    QReadLocker locker(&d->translateMutex);
+
+    QByteArray cacheKey;
+    quint64 cacheGeneration = 0;
+    auto cache = translationCache.isDestroyed() ? nullptr : translationCache();
+    if (cache) {
+        QMutexLocker cacheLocker(&cache->lock);
+        if (cache->enabled) {
+            // Compares the pointers only if a translator is installed or removed meanwhile,
+            // otherwise the lists share the same data
+            if (cache->translators != d->translators) {
+                cache->translators = d->translators;
+                cache->generation++;
+                cache->results.clear();
+            }
+
+            const char sep = '\0';
+            cacheKey = QByteArray(context) + sep + QByteArray(sourceText) + sep +
+                       QByteArray(disambiguation) + sep + QByteArray::number(n);
+            cacheGeneration = cache->generation;
+
+            auto it = cache->results.constFind(cacheKey);
+            if (it != cache->results.constEnd()) {
+                if (ok)
+                    *ok = it->second;
+                return it->first;
             }
         }
     }
 
-    if (result.isNull()) {
+    if (!d->translators.isEmpty()) {
+        QList<QTranslator *>::ConstIterator it;
+        QTranslator *translationFile;
+        for (it = d->translators.constBegin(); it != d->translators.constEnd(); ++it) {
+            translationFile = *it;
+            result = translationFile->translate(context, sourceText, disambiguation, n);
+            if (!result.isNull())
+                break;
+        }
+    }
+
+    const bool found = !result.isNull();
+    if (!found) {
         result = QString::fromUtf8(sourceText);
     } else if (ok) {
         *ok = true;
     }
     replacePercentN(&result, n);
+
+    // The cache may have been cleared during the lookup
+    if (!cacheKey.isEmpty()) {
+        QMutexLocker cacheLocker(&cache->lock);
+        if (cache->enabled && cache->generation == cacheGeneration) {
+            if (cache->results.size() >= MaxTranslationCacheSize) {
+                cache->results.clear();
+            }
+            cache->results.insert(cacheKey, qMakePair(result, found));
+        }
+    }
     return result;
 }
 
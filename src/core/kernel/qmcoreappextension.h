@@ -64,6 +64,7 @@ public:
 
     static QString translate(const char *context, const char *sourceText,
                              const char *disambiguation = nullptr, int n = -1, bool *ok = nullptr);
+    static void clearTranslationCache();
 
 protected:
     QMCoreAppExtension(QMCoreAppExtensionPrivate &d, QObject *parent = nullptr);
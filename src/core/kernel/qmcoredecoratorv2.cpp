@@ -1,17 +1,29 @@
 #include "qmcoredecoratorv2.h"
 #include "qmcoredecoratorv2_p.h"
 
+#include <limits>
+
 #include <QCoreApplication>
 #include <QDebug>
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QLocale>
-#include <QRegularExpression>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+#include "qmconcurrent_p.h"
+#include "qmcoreappextension.h"
+#include "qmmergedtranslator_p.h"
+#include "qmtranslationindex_p.h"
 
 static QMCoreDecoratorV2 *m_instance = nullptr;
 
 QMCoreDecoratorV2Private::QMCoreDecoratorV2Private() {
     qmFilesDirty = false;
+    localeSerial = 0;
+    mergeTranslations = false;
 }
 
 QMCoreDecoratorV2Private::~QMCoreDecoratorV2Private() {
@@ -21,48 +33,87 @@ void QMCoreDecoratorV2Private::init() {
     currentLocale = QLocale::system().name();
 }
 
-static QMap<QString, QStringList> scanTranslation_helper(const QString &path) {
-    QMap<QString, QStringList> res;
-
-    QFileInfoList searchFiles;
-    QStringList searchPaths = {path};
-    while (!searchPaths.isEmpty()) {
-        const QDir dir(searchPaths.takeFirst());
-        const QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::NoSymLinks);
-        foreach (const QFileInfo &file, files) {
-            if (!file.suffix().compare("qm", Qt::CaseInsensitive)) {
-                searchFiles.append(file);
-            }
+namespace {
+
+    // The contents of a translation file, mapped if the file system supports it
+    struct TranslationData {
+        QSharedPointer<QFile> file; // Owns the mapping
+        const uchar *mapped = nullptr;
+        QByteArray contents; // Read if the file can't be mapped
+        int size = 0;
+
+        inline const uchar *data() const {
+            return mapped ? mapped : reinterpret_cast<const uchar *>(contents.constData());
         }
-        const QFileInfoList dirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
-        foreach (const QFileInfo &subdir, dirs)
-            searchPaths << subdir.absoluteFilePath();
-    }
+    };
 
-    QRegularExpression reg(R"((\w+?)_(\w{2})(_\w+|))");
-    for (const auto &file : qAsConst(searchFiles)) {
-        auto match = reg.match(file.fileName());
-        if (!match.hasMatch()) {
-            continue;
+    // QTranslator doesn't copy the data it's loaded from
+    class DataTranslator : public QTranslator {
+    public:
+        explicit DataTranslator(const TranslationData &data, QObject *parent = nullptr)
+            : QTranslator(parent), data(data) {
         }
 
-        QLocale testLocale(match.captured(2) + match.captured(3));
-        if (testLocale.language() == QLocale::C)
-            continue;
-        res[testLocale.name()].append(file.absoluteFilePath());
-    }
+        inline bool loadData(const QString &directory) {
+            return load(data.data(), data.size, directory);
+        }
+
+        inline QByteArray catalog() const {
+            return QByteArray::fromRawData(reinterpret_cast<const char *>(data.data()), data.size);
+        }
+
+        TranslationData data;
+    };
+
+}
+
+// Maps the translation files, it's safe to call on any thread
+static QVector<TranslationData> readTranslation_helper(const QStringList &paths) {
+    QVector<TranslationData> res(paths.size());
+    auto resData = res.data();
+    QMPrivate::parallelFor(paths.size(), [&](int i) {
+        auto file = QSharedPointer<QFile>::create(paths.at(i));
+        if (!file->open(QIODevice::ReadOnly)) {
+            return;
+        }
+        const qint64 size = file->size();
+        if (size <= 0 || size > std::numeric_limits<int>::max()) {
+            return;
+        }
+
+        auto &data = resData[i];
+        if (auto mapped = file->map(0, size)) {
+            // The mapping stays valid until the file object is destroyed, which happens on the
+            // thread of the application along with the translator
+            file->close();
+            file->moveToThread(QCoreApplication::instance()->thread());
+            data.file = file;
+            data.mapped = mapped;
+            data.size = int(size);
+            return;
+        }
+        data.contents = file->readAll();
+        data.size = data.contents.size();
+    });
     return res;
 }
 
-static QList<QTranslator *> installTranslation_helper(const QStringList &paths) {
+// Creates the translators from the contents on the thread of the application, since loading
+// a translator checks whether it's installed without locking the translator list of Qt
+static QList<QTranslator *> loadTranslation_helper(const QStringList &paths,
+                                                   const QVector<TranslationData> &contents) {
     QList<QTranslator *> res;
-    for (const auto &file : qAsConst(paths)) {
-        auto t = new QTranslator(qApp);
-        if (!t->load(file)) {
+    for (int i = 0; i < paths.size(); ++i) {
+        const auto &data = contents.at(i);
+        if (data.size == 0) {
+            continue;
+        }
+
+        auto t = new DataTranslator(data, qApp);
+        if (!t->loadData(QFileInfo(paths.at(i)).absolutePath())) {
             delete t;
             continue;
         }
-        qApp->installTranslator(t);
         res.append(t);
     }
     return res;
@@ -72,12 +123,39 @@ void QMCoreDecoratorV2Private::scanTranslations() const {
     qmFiles.clear();
 
     for (const auto &path : qAsConst(translationPaths)) {
-        insertTranslationFiles_helper(scanTranslation_helper(path));
+        insertTranslationFiles_helper(scanTranslationPath(path));
     }
 
     qmFilesDirty = false;
 }
 
+/*!
+    \internal
+
+    Returns the \c *.qm files of each locale in the path. If the cache is enabled, the cached
+    index is used as long as the directories and the indexed files are not modified, so that the
+    directories don't need to be listed and the files don't need to be matched again.
+*/
+QMap<QString, QStringList> QMCoreDecoratorV2Private::scanTranslationPath(
+    const QString &path) const {
+    if (translationCacheDir.isEmpty()) {
+        return QMTranslationIndex::scan(path).files;
+    }
+
+    const QString cacheFile = QMTranslationIndex::cacheFileName(translationCacheDir, path);
+
+    QMTranslationIndex index;
+    if (index.load(cacheFile) && index.path == path && index.isUpToDate()) {
+        return index.files;
+    }
+
+    index = QMTranslationIndex::scan(path);
+    if (!index.save(cacheFile)) {
+        qCWarning(qAppExtLog) << "failed to write translation index" << cacheFile;
+    }
+    return index.files;
+}
+
 void QMCoreDecoratorV2Private::insertTranslationFiles_helper(
     const QMap<QString, QStringList> &map) const {
     for (auto it = map.begin(); it != map.end(); ++it) {
@@ -88,6 +166,62 @@ void QMCoreDecoratorV2Private::insertTranslationFiles_helper(
     }
 }
 
+/*!
+    \internal
+
+    Installs the loaded translators and returns the installed ones. If the translations are
+    merged, a merged translator owning the loaded ones is installed instead.
+*/
+QList<QTranslator *> QMCoreDecoratorV2Private::installTranslators(
+    const QList<QTranslator *> &translators) const {
+    if (!mergeTranslations || translators.size() <= 1) {
+        for (const auto &t : translators) {
+            qApp->installTranslator(t);
+        }
+        return translators;
+    }
+
+    // The translator installed last takes precedence in QCoreApplication
+    QList<QTranslator *> ordered;
+    QList<QByteArray> catalogs;
+    for (auto it = translators.rbegin(); it != translators.rend(); ++it) {
+        ordered.append(*it);
+
+        // All of them are created by loadTranslation_helper()
+        catalogs.append(static_cast<DataTranslator *>(*it)->catalog());
+    }
+    auto merged = new QMMergedTranslator(ordered, catalogs, qApp);
+    qApp->installTranslator(merged);
+    return {merged};
+}
+
+/*!
+    \internal
+
+    Replaces the installed translators with the loaded ones and notifies the subscribers.
+*/
+void QMCoreDecoratorV2Private::switchLocale(const QString &locale,
+                                            const QList<QTranslator *> &translators) {
+    Q_Q(QMCoreDecoratorV2);
+
+    // Remove original translators
+    qDeleteAll(this->translators);
+    this->translators.clear();
+
+    // Set new locale
+    currentLocale = locale;
+
+    // Install new translators at once
+    this->translators = installTranslators(translators);
+    QMCoreAppExtension::clearTranslationCache();
+
+    for (const auto &item : qAsConst(localeSubscribers))
+        for (const auto &updater : qAsConst(item))
+            updater();
+
+    Q_EMIT q->localeChanged(locale);
+}
+
 void QMCoreDecoratorV2Private::_q_localeSubscriberDestroyed() {
     localeSubscribers.remove(sender());
 }
@@ -145,7 +279,7 @@ void QMCoreDecoratorV2::addTranslationPath(const QString &path) {
     }
 
     // Support incremental update when adding path
-    auto map = scanTranslation_helper(path);
+    auto map = d->scanTranslationPath(path);
     d->insertTranslationFiles_helper(map);
 
     // Install new translators
@@ -153,8 +287,9 @@ void QMCoreDecoratorV2::addTranslationPath(const QString &path) {
     if (it == map.end()) {
         return;
     }
-    auto translators = installTranslation_helper(it.value());
-    d->translators.append(translators);
+    auto translators = loadTranslation_helper(it.value(), readTranslation_helper(it.value()));
+    d->translators.append(d->installTranslators(translators));
+    QMCoreAppExtension::clearTranslationCache();
 
     for (const auto &item : qAsConst(d->localeSubscribers))
         for (const auto &updater : qAsConst(item))
@@ -183,6 +318,50 @@ void QMCoreDecoratorV2::removeTranslationPath(const QString &path) {
     d->qmFilesDirty = true;
 }
 
+/*!
+    Returns the directory where the indexes of the translation paths are stored.
+*/
+QString QMCoreDecoratorV2::translationCacheDirectory() const {
+    Q_D(const QMCoreDecoratorV2);
+    return d->translationCacheDir;
+}
+
+/*!
+    Sets the directory where the indexes of the translation paths are stored, an empty string
+    disables the cache.
+
+    When the cache is enabled, the translation files found in a path are written to the
+    directory, and are reused as long as none of the directories in the path and the found files
+    has been modified. Only their stamps are checked on the next startup instead of listing all
+    files.
+*/
+void QMCoreDecoratorV2::setTranslationCacheDirectory(const QString &dir) {
+    Q_D(QMCoreDecoratorV2);
+    d->translationCacheDir = dir;
+}
+
+/*!
+    Returns true if the translation files of a locale are merged into one translator.
+*/
+bool QMCoreDecoratorV2::isTranslationMergeEnabled() const {
+    Q_D(const QMCoreDecoratorV2);
+    return d->mergeTranslations;
+}
+
+/*!
+    Sets whether the translation files of a locale are merged into one translator, which is
+    disabled by default. It takes effect when the translations are loaded next time.
+
+    When the translations are merged, the messages of all translation files are put in one table
+    when they are loaded. A message is only looked up in the files that have it, in the same
+    order as they are installed separately, so that the lookups don't depend on the number of
+    the translation files.
+*/
+void QMCoreDecoratorV2::setTranslationMergeEnabled(bool enabled) {
+    Q_D(QMCoreDecoratorV2);
+    d->mergeTranslations = enabled;
+}
+
 /*!
     Returns a list of locale names.
 */
@@ -208,31 +387,80 @@ QString QMCoreDecoratorV2::locale() const {
 void QMCoreDecoratorV2::setLocale(const QString &locale) {
     Q_D(QMCoreDecoratorV2);
 
+    // Drop the pending asynchronous switch
+    d->localeSerial++;
+
     if (d->qmFilesDirty) {
         d->scanTranslations();
     } else if (d->currentLocale == locale) {
         return;
     }
 
-    // Remove original translators
-    qDeleteAll(d->translators);
-    d->translators.clear();
-
-    // Set new locale
-    d->currentLocale = locale;
-
-    // Install new translators
+    // Load new translators before removing the original ones, which stay in use meanwhile
+    QList<QTranslator *> translators;
     auto it = d->qmFiles.find(locale);
     if (it != d->qmFiles.end()) {
-        auto translators = installTranslation_helper(it.value());
-        d->translators.append(translators);
+        translators = loadTranslation_helper(it.value(), readTranslation_helper(it.value()));
     }
+    d->switchLocale(locale, translators);
+}
 
-    for (const auto &item : qAsConst(d->localeSubscribers))
-        for (const auto &updater : qAsConst(item))
-            updater();
+/*!
+    Sets the current locale without blocking the event loop, the translation files are mapped
+    on the thread pool.
+
+    The original translators stay installed until all new translation files are mapped, then the
+    translators are replaced at once on this thread and the subscribers are notified. A later
+    call of setLocale() or setLocaleAsync() discards the switch in progress.
+
+    The \c localeSwitchFinished signal is emitted once for every call, after \c localeChanged if
+    the locale is switched.
+*/
+void QMCoreDecoratorV2::setLocaleAsync(const QString &locale) {
+    Q_D(QMCoreDecoratorV2);
+
+    const int serial = ++d->localeSerial;
 
-    Q_EMIT localeChanged(locale);
+    // Reported asynchronously as well
+    if (!d->qmFilesDirty && d->currentLocale == locale) {
+        QMetaObject::invokeMethod(
+            this, [this, locale]() { Q_EMIT localeSwitchFinished(locale, true); },
+            Qt::QueuedConnection);
+        return;
+    }
+
+    if (d->qmFilesDirty) {
+        d->scanTranslations();
+    }
+
+    // Only the files are mapped by the worker, the decorator is accessed on this thread
+    struct LoadTask {
+        QPointer<QMCoreDecoratorV2> decorator;
+        QStringList paths;
+        QVector<TranslationData> contents;
+    };
+
+    auto task = QSharedPointer<LoadTask>::create();
+    task->decorator = this;
+    task->paths = d->qmFiles.value(locale);
+
+    auto finish = [task, serial, locale]() {
+        auto q = task->decorator.data();
+        if (!q) {
+            return;
+        }
+        if (q->d_func()->localeSerial != serial) {
+            Q_EMIT q->localeSwitchFinished(locale, false);
+            return;
+        }
+        q->d_func()->switchLocale(locale, loadTranslation_helper(task->paths, task->contents));
+        Q_EMIT q->localeSwitchFinished(locale, true);
+    };
+
+    QThreadPool::globalInstance()->start([task, finish]() {
+        task->contents = readTranslation_helper(task->paths);
+        QMetaObject::invokeMethod(qApp, finish, Qt::QueuedConnection);
+    });
 }
 
 /*!
@@ -268,6 +496,13 @@ void QMCoreDecoratorV2::installLocale(QObject *o, const std::function<void()> &u
     This signal is emitted when the current locale changes.
 */
 
+/*!
+    \fn void QMCoreDecoratorV2::localeSwitchFinished(const QString &locale, bool applied)
+
+    This signal is emitted when a switch started by setLocaleAsync() finishes, \a applied is
+    false if the switch is discarded by a later one.
+*/
+
 /*!
     \internal
 */
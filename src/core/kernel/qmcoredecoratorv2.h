@@ -22,9 +22,16 @@ public:
     void addTranslationPath(const QString &path);
     void removeTranslationPath(const QString &path);
 
+    QString translationCacheDirectory() const;
+    void setTranslationCacheDirectory(const QString &dir);
+
+    bool isTranslationMergeEnabled() const;
+    void setTranslationMergeEnabled(bool enabled);
+
     QStringList locales() const;
     QString locale() const;
     void setLocale(const QString &locale);
+    void setLocaleAsync(const QString &locale);
     void refreshLocale();
 
     void installLocale(QObject *o, const std::function<void()> &updater);
@@ -55,6 +62,7 @@ public:
 
 Q_SIGNALS:
     void localeChanged(const QString &locale);
+    void localeSwitchFinished(const QString &locale, bool applied);
 
 protected:
     QMCoreDecoratorV2(QMCoreDecoratorV2Private &d, QObject *parent = nullptr);
@@ -26,15 +26,22 @@ public:
     void init();
 
     void scanTranslations() const;
+    QMap<QString, QStringList> scanTranslationPath(const QString &path) const;
 
     void insertTranslationFiles_helper(const QMap<QString, QStringList> &map) const;
 
+    QList<QTranslator *> installTranslators(const QList<QTranslator *> &translators) const;
+    void switchLocale(const QString &locale, const QList<QTranslator *> &translators);
+
     QMCoreDecoratorV2 *q_ptr;
 
     QSet<QString> translationPaths;
     QList<QTranslator *> translators;
     QString currentLocale;
+    int localeSerial; // Increased by every switch, the stale asynchronous switches are dropped
     QHash<QObject *, QList<std::function<void()>>> localeSubscribers;
+    QString translationCacheDir;
+    bool mergeTranslations;
 
     mutable bool qmFilesDirty;
     mutable QMap<QString, QStringList> qmFiles;
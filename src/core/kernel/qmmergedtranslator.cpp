@@ -0,0 +1,165 @@
+#include "qmmergedtranslator_p.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QVarLengthArray>
+#include <QtEndian>
+
+// The tags of the blocks of a .qm file that matter here, see qtranslator.cpp
+enum QmTag {
+    QmTag_Hashes = 0x42,
+    QmTag_Dependencies = 0x96,
+};
+
+static const uchar QmMagic[16] = {
+    0x3c, 0xb8, 0x64, 0x18, 0xca, 0xef, 0x9c, 0x95, 0xcd, 0x21, 0x1c, 0xbf, 0x60, 0xa1, 0xbd, 0xdd,
+};
+
+static inline void elfHash_continue(const char *name, quint32 &h) {
+    auto k = reinterpret_cast<const uchar *>(name);
+    quint32 g;
+    while (*k) {
+        h = (h << 4) + *k++;
+        if ((g = (h & 0xf0000000)) != 0)
+            h ^= g >> 24;
+        h &= ~g;
+    }
+}
+
+// The hash of a message in the catalogs, the same as the one of QTranslator
+static quint32 messageHash(const char *sourceText, const char *comment) {
+    quint32 h = 0;
+    elfHash_continue(sourceText, h);
+    elfHash_continue(comment, h);
+    return h ? h : 1;
+}
+
+// Appends the message hashes of a catalog to the table. Returns false if it's not a .qm file, or
+// it depends on other catalogs, which QTranslator loads and looks up after its own messages.
+static bool readCatalogHashes(const QByteArray &catalog, int index,
+                              QVector<QPair<quint32, int>> *table) {
+    const auto data = reinterpret_cast<const uchar *>(catalog.constData());
+    const int size = catalog.size();
+    if (size < int(sizeof(QmMagic)) || memcmp(data, QmMagic, sizeof(QmMagic)) != 0) {
+        return false;
+    }
+
+    // Each block is a tag, a 32-bit length and the data
+    const uchar *hashes = nullptr;
+    quint32 hashesLength = 0;
+    int pos = sizeof(QmMagic);
+    while (pos < size - 5) {
+        const uchar tag = data[pos];
+        const quint32 length = qFromBigEndian<quint32>(data + pos + 1);
+        pos += 5;
+        if (!tag || !length) {
+            break;
+        }
+        if (length > quint32(size - pos)) {
+            return false;
+        }
+        if (tag == QmTag_Dependencies) {
+            return false;
+        }
+        if (tag == QmTag_Hashes) {
+            hashes = data + pos;
+            hashesLength = length;
+        }
+        pos += int(length);
+    }
+
+    // The hashes and the offsets of the messages, sorted by the hashes
+    quint32 last = 0;
+    for (quint32 i = 0; i + 8 <= hashesLength; i += 8) {
+        const quint32 h = qFromBigEndian<quint32>(hashes + i);
+        if (h != last) {
+            table->append(qMakePair(h, index));
+            last = h;
+        }
+    }
+    return true;
+}
+
+/*!
+    \class QMMergedTranslator
+    \internal
+
+    The QMMergedTranslator class combines several translators into one. The message hashes of
+    all catalogs are put in one table when it's created, so that a lookup only goes to the
+    translators that have the message, in the given order, no matter how many catalogs there
+    are. The table is never modified afterwards, so the lookups don't need any lock.
+
+    \a catalogs are the .qm data the translators are loaded from, which is only read in the
+    constructor. The translators whose catalogs are missing or can't be read are looked up for
+    every message.
+
+    The merged translator takes the ownership of the translators.
+*/
+
+QMMergedTranslator::QMMergedTranslator(const QList<QTranslator *> &translators,
+                                       const QList<QByteArray> &catalogs, QObject *parent)
+    : QTranslator(parent), translators(translators) {
+    for (int i = 0; i < translators.size(); ++i) {
+        translators.at(i)->setParent(this);
+        if (!readCatalogHashes(catalogs.value(i), i, &table)) {
+            unindexed.append(i);
+        }
+    }
+
+    // The translators having the same hash are in the order of precedence
+    std::sort(table.begin(), table.end());
+    table.squeeze();
+}
+
+QMMergedTranslator::~QMMergedTranslator() {
+}
+
+QString QMMergedTranslator::translate(const char *context, const char *sourceText,
+                                      const char *disambiguation, int n) const {
+    if (!sourceText)
+        sourceText = "";
+    if (!disambiguation)
+        disambiguation = "";
+
+    QVarLengthArray<int, 8> candidates;
+    const auto findHash = [&](quint32 h) {
+        const auto range = std::equal_range(
+            table.begin(), table.end(), qMakePair(h, 0),
+            [](const QPair<quint32, int> &a, const QPair<quint32, int> &b) {
+                return a.first < b.first;
+            });
+        for (auto it = range.first; it != range.second; ++it) {
+            candidates.append(it->second);
+        }
+    };
+
+    // QTranslator looks up the message with the disambiguation first and then without it
+    findHash(messageHash(sourceText, disambiguation));
+    if (*disambiguation) {
+        findHash(messageHash(sourceText, ""));
+    }
+    candidates.append(unindexed.constData(), unindexed.size());
+    if (candidates.size() > 1) {
+        std::sort(candidates.begin(), candidates.end());
+        candidates.resize(int(std::unique(candidates.begin(), candidates.end()) -
+                              candidates.begin()));
+    }
+
+    for (const auto &i : candidates) {
+        QString res = translators.at(i)->translate(context, sourceText, disambiguation, n);
+        if (!res.isNull()) {
+            return res;
+        }
+    }
+    return QString();
+}
+
+bool QMMergedTranslator::isEmpty() const {
+    for (const auto &t : translators) {
+        if (!t->isEmpty()) {
+            return false;
+        }
+    }
+    return true;
+}
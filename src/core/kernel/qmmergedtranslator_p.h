@@ -0,0 +1,39 @@
+#ifndef QMMERGEDTRANSLATOR_P_H
+#define QMMERGEDTRANSLATOR_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QPair>
+#include <QTranslator>
+#include <QVector>
+
+#include <QMCore/qmglobal.h>
+
+class QM_CORE_EXPORT QMMergedTranslator : public QTranslator {
+public:
+    QMMergedTranslator(const QList<QTranslator *> &translators, const QList<QByteArray> &catalogs,
+                       QObject *parent = nullptr);
+    ~QMMergedTranslator();
+
+    QString translate(const char *context, const char *sourceText,
+                      const char *disambiguation = nullptr, int n = -1) const override;
+    bool isEmpty() const override;
+
+private:
+    QList<QTranslator *> translators; // The first one takes precedence
+
+    // [ message hash, translator index ], sorted, the messages of all catalogs in one table
+    QVector<QPair<quint32, int>> table;
+    QVector<int> unindexed; // The translators whose catalogs can't be read, always looked up
+
+    Q_DISABLE_COPY(QMMergedTranslator)
+};
+
+#endif // QMMERGEDTRANSLATOR_P_H
@@ -0,0 +1,185 @@
+#include "qmtranslationindex_p.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QLocale>
+#include <QRegularExpression>
+#include <QSaveFile>
+
+#include "qmsystem.h"
+
+static const quint32 IndexMagic = 0x514d5449; // QMTI
+
+// Increase the version when the file name matching or the format changes
+static const quint32 IndexVersion = 2;
+
+static QDataStream &operator<<(QDataStream &out, const QMTranslationIndex::DirStamp &stamp) {
+    out << stamp.path << stamp.modifyTime;
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, QMTranslationIndex::DirStamp &stamp) {
+    in >> stamp.path >> stamp.modifyTime;
+    return in;
+}
+
+static QDataStream &operator<<(QDataStream &out, const QMTranslationIndex::FileStamp &stamp) {
+    out << stamp.path << stamp.size << stamp.modifyTime;
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, QMTranslationIndex::FileStamp &stamp) {
+    in >> stamp.path >> stamp.size >> stamp.modifyTime;
+    return in;
+}
+
+static inline qint64 modifyTime(const QFileInfo &info) {
+    return info.lastModified().toMSecsSinceEpoch();
+}
+
+/*!
+    \class QMTranslationIndex
+    \internal
+
+    The QMTranslationIndex class is the result of scanning a translation path for the \c *.qm
+    files of each locale. It's saved to a cache file and stays valid as long as none of the
+    scanned directories and the indexed files is modified. Adding, removing or renaming a file
+    or a directory changes the modification time of its parent directory, while a file that is
+    rewritten in place only changes its own size or modification time.
+*/
+
+/*!
+    \internal
+
+    Reads a cached index.
+*/
+bool QMTranslationIndex::load(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_15);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    in >> magic >> version;
+    if (magic != IndexMagic || version != IndexVersion) {
+        return false;
+    }
+
+    QMTranslationIndex res;
+    in >> res.path >> res.dirs >> res.stamps >> res.files;
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    *this = std::move(res);
+    return true;
+}
+
+/*!
+    \internal
+
+    Writes the index atomically.
+*/
+bool QMTranslationIndex::save(const QString &fileName) const {
+    if (!QM::mkDir(QFileInfo(fileName).absolutePath())) {
+        return false;
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_15);
+    out << IndexMagic << IndexVersion << path << dirs << stamps << files;
+    if (out.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+/*!
+    \internal
+
+    Returns true if none of the scanned directories and the indexed files has been modified.
+*/
+bool QMTranslationIndex::isUpToDate() const {
+    if (dirs.isEmpty()) {
+        return false;
+    }
+    for (const auto &dir : dirs) {
+        const QFileInfo info(dir.path);
+        if (!info.isDir() || modifyTime(info) != dir.modifyTime) {
+            return false;
+        }
+    }
+    for (const auto &stamp : stamps) {
+        const QFileInfo info(stamp.path);
+        if (!info.isFile() || info.size() != stamp.size || modifyTime(info) != stamp.modifyTime) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Searches the path recursively for the \c *.qm files whose names end with a locale name, e.g.
+    \c app_zh_CN.qm.
+*/
+QMTranslationIndex QMTranslationIndex::scan(const QString &path) {
+    QMTranslationIndex res;
+    res.path = path;
+
+    QFileInfoList searchFiles;
+    QStringList searchPaths = {path};
+    while (!searchPaths.isEmpty()) {
+        const QDir dir(searchPaths.takeFirst());
+        res.dirs.append({dir.absolutePath(), modifyTime(QFileInfo(dir.absolutePath()))});
+
+        const QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::NoSymLinks);
+        foreach (const QFileInfo &file, files) {
+            if (!file.suffix().compare("qm", Qt::CaseInsensitive)) {
+                searchFiles.append(file);
+            }
+        }
+        const QFileInfoList dirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
+        foreach (const QFileInfo &subdir, dirs)
+            searchPaths << subdir.absoluteFilePath();
+    }
+
+    static const QRegularExpression reg(R"((\w+?)_(\w{2})(_\w+|))");
+    for (const auto &file : qAsConst(searchFiles)) {
+        auto match = reg.match(file.fileName());
+        if (!match.hasMatch()) {
+            continue;
+        }
+
+        QLocale testLocale(match.captured(2) + match.captured(3));
+        if (testLocale.language() == QLocale::C)
+            continue;
+        res.files[testLocale.name()].append(file.absoluteFilePath());
+        res.stamps.append({file.absoluteFilePath(), file.size(), modifyTime(file)});
+    }
+    return res;
+}
+
+/*!
+    \internal
+
+    Returns the cache file location of the given translation path.
+*/
+QString QMTranslationIndex::cacheFileName(const QString &dir, const QString &path) {
+    const auto &hash = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1);
+    return QDir(dir).filePath(QString::fromLatin1(hash.toHex()) + QStringLiteral(".qmti"));
+}
@@ -0,0 +1,46 @@
+#ifndef QMTRANSLATIONINDEX_P_H
+#define QMTRANSLATIONINDEX_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QList>
+#include <QMap>
+#include <QStringList>
+
+#include <QMCore/qmglobal.h>
+
+class QM_CORE_EXPORT QMTranslationIndex {
+public:
+    struct DirStamp {
+        QString path;
+        qint64 modifyTime;
+    };
+
+    struct FileStamp {
+        QString path;
+        qint64 size;
+        qint64 modifyTime;
+    };
+
+    QString path;
+    QList<DirStamp> dirs; // The scanned directories, including the path itself
+    QList<FileStamp> stamps; // The indexed files
+    QMap<QString, QStringList> files; // locale - *.qm files
+
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    bool isUpToDate() const;
+
+    static QMTranslationIndex scan(const QString &path);
+    static QString cacheFileName(const QString &dir, const QString &path);
+};
+
+#endif // QMTRANSLATIONINDEX_P_H
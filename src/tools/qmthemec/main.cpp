@@ -0,0 +1,65 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+
+#include <QMWidgets/qmdecoratorv2.h>
+#include <QMWidgets/private/qmthemecache_p.h>
+
+static int themeProblemCount = 0;
+static QtMessageHandler defaultMessageHandler = nullptr;
+
+static void messageHandler(QtMsgType type, const QMessageLogContext &context,
+                           const QString &message) {
+    if ((type == QtWarningMsg || type == QtCriticalMsg) && context.category &&
+        qstrcmp(context.category, "qtmediate.theme") == 0) {
+        themeProblemCount++;
+    }
+    defaultMessageHandler(type, context, message);
+}
+
+// Precompiles a theme directory, QMDecoratorV2 loads the output instead of the theme files when
+// it's placed in the theme directory as themes.qmtc
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qmthemec"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Precompiles a theme directory."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("dir"), QStringLiteral("Theme directory."));
+    parser.addPositionalArgument(QStringLiteral("output"),
+                                 QStringLiteral("Output file, defaults to <dir>/themes.qmtc."));
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.isEmpty() || args.size() > 2) {
+        parser.showHelp(1);
+    }
+
+    const QString &dir = args.at(0);
+    const QString output = args.size() > 1 ? args.at(1) : QMThemeCache::compiledFileName(dir);
+
+    QString errorString;
+    if (!QMThemeCache::compile(dir, output, &errorString)) {
+        qWarning().noquote() << "qmthemec:" << errorString;
+        return 1;
+    }
+
+    // Merge the packages and resolve the base themes, the problems such as cyclic variable
+    // references are reported as warnings, which fail the build
+    defaultMessageHandler = qInstallMessageHandler(messageHandler);
+    {
+        QMDecoratorV2 decorator;
+        decorator.addThemePath(dir);
+        decorator.themes();
+    }
+    qInstallMessageHandler(defaultMessageHandler);
+
+    if (themeProblemCount > 0) {
+        qWarning().noquote() << "qmthemec:" << themeProblemCount << "problem(s) found in" << dir;
+        QFile::remove(output);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+
+#include <QMWidgets/private/qmthemebundle_p.h>
+
+// Packs a theme directory into a bundle which can be passed to QMDecoratorV2::addThemePath
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("qmthemepack"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Packs a theme directory into a bundle."));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QStringLiteral("dir"), QStringLiteral("Theme directory."));
+    parser.addPositionalArgument(QStringLiteral("output"),
+                                 QStringLiteral("Bundle file, e.g. theme.qmtb."));
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() != 2) {
+        parser.showHelp(1);
+    }
+
+    const QString &output = args.at(1);
+    if (!QMThemeBundle::isBundleFile(output)) {
+        qWarning().noquote() << "qmthemepack: the bundle file should have the suffix .qmtb";
+        return 1;
+    }
+
+    QString errorString;
+    if (!QMThemeBundle::pack(args.at(0), output, &errorString)) {
+        qWarning().noquote() << "qmthemepack:" << errorString;
+        return 1;
+    }
+    return 0;
+}
@@ -1,28 +1,40 @@
 #include "qmdecoratorv2.h"
 #include "qmdecoratorv2_p.h"
 
+#include <algorithm>
+
 #include <QApplication>
 #include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
 #include <QFileInfo>
-#include <QJsonArray>
-#include <QJsonDocument>
-#include <QJsonObject>
-#include <QRegularExpression>
 #include <QWindow>
-#include <QPixmapCache>
 #include <QTimer>
-#include <QStringView>\
+#include <QStringView>
 
 #include <QMCore/qmchronoset.h>
-#include <QMCore/qmsimplevarexp.h>
+#include <QMCore/qmcoreappextension.h>
 #include <QMCore/qmsystem.h>
 
+#include <QMCore/private/qmconcurrent_p.h>
 #include <QMCore/private/qmcoredecoratorv2_p.h>
 
+#include "qmappextension_p.h"
+#include "qmstylesheetrewriter_p.h"
+#include "qmthemebundle_p.h"
+#include "qmthemecache_p.h"
+
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
 #  define AUTO_SYNC_WITH_DPI
 #endif
 
+// Enable with the rule "qtmediate.theme.debug=true" to log the statistics of scans and refreshes
+Q_LOGGING_CATEGORY(qThemeLog, "qtmediate.theme", QtWarningMsg)
+
+static inline qint64 elapsedMicroseconds(const QElapsedTimer &timer) {
+    return timer.nsecsElapsed() / 1000;
+}
+
 class QMDecoratorThemeGuardV2 : public QObject {
 public:
     explicit QMDecoratorThemeGuardV2(QWidget *w, QMDecoratorV2Private *parent);
@@ -44,11 +56,6 @@ public:
 
 protected:
     bool eventFilter(QObject *obj, QEvent *event) override;
-
-#ifdef AUTO_SYNC_WITH_DPI
-private:
-    void _q_logicalRatioChanged(double dpi);
-#endif
 };
 
 QMDecoratorThemeGuardV2::QMDecoratorThemeGuardV2(QWidget *w, QMDecoratorV2Private *parent)
@@ -70,89 +77,49 @@ void QMDecoratorThemeGuardV2::updateScreen() {
         needUpdate = true;
         return;
     }
+    needUpdate = false;
 
-    auto getStyleSheet = [&](const QString &theme) {
-        QString allStylesheets;
-
-        QString base = theme;
-        QMChronoSet<QString> bases{base};
-        while (!(base = d->variables.value(base).value(QStringLiteral("_base"))).isEmpty() &&
-               !bases.contains(base) // Avoid recursively referenced
-        ) {
-            bases.prepend(base);
-        }
-
-        for (const auto &curTheme : qAsConst(bases)) {
-            auto map = d->stylesheetCaches.value(curTheme, {});
-            if (map.isEmpty()) {
-                continue;
-            }
-
-            // Go through themes
-            for (const auto &id : qAsConst(ids)) {
-                for (const auto &key : d->nsMappings.value(id, {})) {
-                    auto stylesheet = map.value(key, {});
-                    if (stylesheet.isEmpty()) {
-                        continue;
-                    }
-
-                    // Evaluate variables
-                    stylesheet = QMSimpleVarExp::evaluate(
-                        stylesheet, d->variables.value(curTheme, {}), QStringLiteral(R"([^\}]+)"));
-
-                    // Replace font sizes
-                    if (d->fontRatio != 1 && d->fontRatio > 0) {
-                        stylesheet =
-                            QMDecoratorV2Private::replaceFontSizes(stylesheet, d->fontRatio, false);
-                    }
-
-                    // Apply dpi and zoom ratio
-#ifdef AUTO_SYNC_WITH_DPI
-                    double ratio = screen->logicalDotsPerInch() / QM::unitDpi();
-#else
-                    double ratio = 1.0;
-#endif
-                    ratio *= d->zoomRatio;
-                    if (ratio != 1 && ratio > 0) {
-                        stylesheet = QMDecoratorV2Private::replaceSizes(stylesheet, ratio, true);
-                    }
-
-                    // Zoom
-                    allStylesheets += stylesheet + QStringLiteral("\n\n");
-                }
-            }
-        }
+    // Apply dpi and zoom ratio
+    const double ratio = d->screenRatio(screen) * d->zoomRatio;
 
-        return allStylesheets;
-    };
+    auto &stats = d->refreshStatistics;
+    const bool recording = d->refreshTimer.isValid();
+    QElapsedTimer timer;
+    timer.start();
 
-    QString stylesheets = getStyleSheet(QStringLiteral("_common"));
-    if (!stylesheets.isEmpty()) {
-        stylesheets += QStringLiteral("\n\n");
+    const QString &stylesheets = d->themeStyleSheet(ids, ratio);
+    if (recording) {
+        stats.evaluateTime += elapsedMicroseconds(timer);
     }
-    stylesheets += getStyleSheet(d->currentTheme);
-
     if (stylesheets.isEmpty())
         return;
 
+    // Qt parses the style sheet and repolishes the widget tree on every call, even if the
+    // content is the same. The results are shared strings, which are compared first.
+    const QString &current = w->styleSheet();
+    if (current.isSharedWith(stylesheets) || current == stylesheets) {
+        if (recording) {
+            stats.unchangedCount++;
+        }
+        return;
+    }
+
+    timer.restart();
     w->setStyleSheet(stylesheets);
+    if (recording) {
+        stats.applyTime += elapsedMicroseconds(timer);
+        stats.restyledCount++;
+    }
 }
 
 void QMDecoratorThemeGuardV2::switchScreen(QScreen *screen) {
     if (!screen || this->screen == screen)
         return;
-#ifdef AUTO_SYNC_WITH_DPI
-    if (this->screen) {
-        disconnect(this->screen.data(), &QScreen::logicalDotsPerInchChanged, this,
-                   &QMDecoratorThemeGuardV2::_q_logicalRatioChanged);
-    }
-#endif
+
+    d->moveScreenSubscriber(this, this->screen, screen);
     this->screen = screen;
-#ifdef AUTO_SYNC_WITH_DPI
-    connect(screen, &QScreen::logicalDotsPerInchChanged, this,
-            &QMDecoratorThemeGuardV2::_q_logicalRatioChanged);
-#endif
 
+    // The style sheets of the screen ratio are usually evaluated already
     updateScreen();
 }
 
@@ -166,10 +133,11 @@ bool QMDecoratorThemeGuardV2::eventFilter(QObject *obj, QEvent *event) {
                 winHandle = w->window()->windowHandle();
                 connect(winHandle, &QWindow::screenChanged, this,
                         &QMDecoratorThemeGuardV2::switchScreen);
+            }
 
-                if (needUpdate) {
-                    updateScreen();
-                }
+            // Theme changes made while the widget was hidden
+            if (needUpdate) {
+                updateScreen();
             }
             break;
         }
@@ -179,20 +147,20 @@ bool QMDecoratorThemeGuardV2::eventFilter(QObject *obj, QEvent *event) {
     return QObject::eventFilter(obj, event);
 }
 
-#ifdef AUTO_SYNC_WITH_DPI
-void QMDecoratorThemeGuardV2::_q_logicalRatioChanged(double dpi) {
-    Q_UNUSED(dpi)
-
-    updateScreen();
-}
-#endif
-
 QMDecoratorV2Private::QMDecoratorV2Private() {
     fontRatio = 1.0;
     zoomRatio = 1.0;
     hasPendingRefreshTask = false;
+    hasPendingRefreshSlice = false;
+    notifyAfterRefresh = false;
+    themeGeneration = 0;
+    styleSheetResultsGeneration = 0;
+    formattedSerial = 0;
+    inactiveThemeLimit = 1;
     themeFilesDirty = false;
     themeArgsDirty = false;
+    themeWatcher = nullptr;
+    themeWatchTimer = nullptr;
     currentTheme = QString();
 }
 
@@ -202,547 +170,1269 @@ QMDecoratorV2Private::~QMDecoratorV2Private() {
 void QMDecoratorV2Private::init() {
 }
 
-namespace {
+// Joins the contents of the items, the items that failed to be read are skipped
+static QString joinStyleSheets(const QMDecoratorV2Private::QssItemList &items) {
+    QString res;
+    for (const auto &item : items) {
+        if (!item->loaded) {
+            continue;
+        }
+        res.append(item->result + QStringLiteral("\n\n"));
+    }
+    return res;
+}
 
-    struct QssItem {
-        double ratio;
-        QString content;
-        QString fileName;
+// The results are dropped when there are too many, e.g. after zooming continuously
+static const int MaxStyleSheetResults = 4096;
 
-        friend QDebug operator<<(QDebug debug, const QssItem &item) {
-            debug << "QssItem(" << item.ratio << ", "
-                  << (item.fileName.isEmpty() ? item.content : item.fileName) << ")";
-            return debug;
-        }
-    };
+// Formatted texts kept for each namespace, e.g. for the screens of different ratios
+static const int MaxFormattedCount = 4;
 
-}
+// Milliseconds to wait for more changes of the watched theme files
+static const int ThemeWatchDelay = 200;
 
-static const QStringList &platformKeys() {
-    static QStringList keys{
-#ifdef Q_OS_WINDOWS
-        QStringLiteral("win"),
-        QStringLiteral("win32"),
-        QStringLiteral("windows"),
-#elif defined(Q_OS_LINUX)
-        QStringLiteral("linux"),
-#else
-        QStringLiteral("mac"),
-        QStringLiteral("macos"),
-        QStringLiteral("osx"),
-        QStringLiteral("macosx"),
-#endif
-    };
-    return keys;
-}
+/*!
+    \internal
 
-template <class T>
-static T parsePlatform(const QJsonValue &val, bool(predicate)(const QJsonValue &),
-                       T(convert)(const QJsonValue &), const T &defaultValue = T{}) {
-    if (predicate(val)) {
-        return convert(val);
+    Returns the style sheet of the current theme for the ids, the results are shared by all
+    subscribers until the theme generation changes.
+
+    The zoom and font ratios don't change the generation. Each namespace keeps its recently
+    formatted texts by the scaled sizes, so a ratio that rounds to the same sizes reuses the
+    texts and the style sheet built from them, which the subscribers already have.
+
+    Switching the theme doesn't change the generation either, the results of the loaded themes
+    are kept and the identical results of different themes are the same shared string. The
+    subscribers whose style sheets are the same in both themes, e.g. the namespaces that only
+    the common base theme defines, are skipped by comparing the string pointers.
+*/
+QString QMDecoratorV2Private::themeStyleSheet(const QStringList &ids, double ratio) const {
+    if (styleSheetResultsGeneration != themeGeneration ||
+        styleSheetResults.size() >= MaxStyleSheetResults ||
+        styleSheetPool.size() >= MaxStyleSheetResults) {
+        styleSheetResults.clear();
+        styleSheetParts.clear();
+        styleSheetPool.clear();
+        styleSheetResultsGeneration = themeGeneration;
     }
 
-    auto obj = val.toObject();
-    for (auto it = obj.begin(); it != obj.end(); ++it) {
-        if (platformKeys().contains(it.key(), Qt::CaseInsensitive)) {
-            if (predicate(it.value())) {
-                return convert(it.value());
-            }
-            return defaultValue;
+    const QChar sep(QChar::Null);
+    const QString cacheKey = currentTheme + sep + ids.join(sep) + sep +
+                             QString::number(ratio, 'g', 17) + sep +
+                             QString::number(fontRatio, 'g', 17);
+    auto it = styleSheetResults.constFind(cacheKey);
+    if (it != styleSheetResults.constEnd()) {
+        if (refreshTimer.isValid()) {
+            refreshStatistics.cacheHitCount++;
         }
+        return it.value();
     }
-    return defaultValue;
-};
 
-static double parsePlatformDouble(const QJsonValue &val, double defaultValue = 0) {
-    return parsePlatform<double>(
-        val, [](const QJsonValue &val) { return val.isDouble(); },
-        [](const QJsonValue &val) { return val.toDouble(); }, defaultValue);
-}
+    // Returns the text of the base theme in the namespace scaled by the ratios
+    auto format = [&](FlattenedNamespace &ns, int i) -> const FlattenedNamespace::Formatted & {
+        const auto &tpl = ns.templates.at(i);
+        const auto &sizes = tpl.scaledSizes(ratio, fontRatio, true);
 
-static QString parsePlatformString(const QJsonValue &val, const QString &defaultValue = {}) {
-    return parsePlatform<QString>(
-        val, [](const QJsonValue &val) { return val.isString(); },
-        [](const QJsonValue &val) { return val.toString(); }, defaultValue);
-}
+        auto &formatted = ns.formatted[i];
+        for (int j = 0; j < formatted.size(); ++j) {
+            if (formatted.at(j).sizes == sizes) {
+                formatted.move(j, 0);
+                return formatted.first();
+            }
+        }
+
+        if (formatted.size() >= MaxFormattedCount) {
+            formatted.removeLast();
+        }
+        formatted.prepend({sizes, tpl.format(ratio, fontRatio, true), ++formattedSerial});
+        if (refreshTimer.isValid()) {
+            refreshStatistics.formatCount++;
+        }
+        return formatted.first();
+    };
 
-// int QMDecoratorV2Private::globalImageCacheSerialNum = 0;
+    QStringList parts;
+    QString partsKey;
 
-void QMDecoratorV2Private::scanForThemes() const {
-    stylesheetCaches.clear();
-    nsMappings.clear();
-    variables.clear();
+    auto collectStyleSheets = [&](const QString &theme) {
+        auto themeIt = flattenedThemes.find(theme);
+        if (themeIt == flattenedThemes.end()) {
+            return;
+        }
+        if (!themeIt->loaded) {
+            loadTheme(theme);
+        }
+
+        // Namespaces of the ids
+        QVector<FlattenedNamespace *> namespaces;
+        for (const auto &id : qAsConst(ids)) {
+            for (const auto &key : nsMappings.value(id, {})) {
+                auto it = themeIt->namespaces.find(key);
+                if (it == themeIt->namespaces.end()) {
+                    continue;
+                }
 
-    QFileInfoList searchFiles;
-    for (const auto &path : qAsConst(themePaths)) {
-        QStringList searchPaths = {path};
-        while (!searchPaths.isEmpty()) {
-            const QDir dir(searchPaths.takeFirst());
-            const QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::NoSymLinks);
-            foreach (const QFileInfo &file, files) {
-                if (!file.completeSuffix().compare(QStringLiteral("res.json"),
-                                                   Qt::CaseInsensitive)) {
-                    searchFiles.append(file);
+                // Evaluate variables, which don't change until the themes are merged
+                auto &ns = it.value();
+                if (ns.templates.isEmpty()) {
+                    ns.templates.resize(ns.sources.size());
+                    ns.formatted.resize(ns.sources.size());
+                    for (int i = 0; i < ns.sources.size(); ++i) {
+                        const auto &source = ns.sources.at(i);
+                        if (source.first.isEmpty()) {
+                            continue;
+                        }
+                        ns.templates[i] = QMStyleSheetTemplate::fromSizes(
+                            QMStyleSheetTemplate::fromVariables(joinStyleSheets(source.first))
+                                .bind(source.second));
+                        if (refreshTimer.isValid()) {
+                            refreshStatistics.templateCount++;
+                        }
+                    }
                 }
+                namespaces.append(&ns);
             }
-            const QFileInfoList dirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
-            foreach (const QFileInfo &subdir, dirs)
-                searchPaths << subdir.absoluteFilePath();
         }
-    }
 
-    // theme - [ namespace - [ priority - items] ]
-    QMap<QString, QMap<QString, QMap<double, QList<QssItem>>>> tmp;
+        // Go through base themes, the style sheets of the bases come first
+        for (int i = 0; i < themeIt->bases.size(); ++i) {
+            for (const auto &ns : qAsConst(namespaces)) {
+                if (ns->templates.at(i).text.isEmpty()) {
+                    continue;
+                }
 
-    QHash<QString, QHash<QString, double>> variablesPriorities;
-    for (const auto &file : searchFiles) {
-        QFile f(file.absoluteFilePath());
-        if (!f.open(QIODevice::ReadOnly)) {
-            continue;
+                const auto &formatted = format(*ns, i);
+                parts.append(formatted.text);
+                partsKey += QString::number(formatted.serial, 16) + QLatin1Char(',');
+            }
         }
+    };
 
-        QByteArray data(f.readAll());
-        f.close();
+    collectStyleSheets(QStringLiteral("_common"));
+    const int commonCount = parts.size();
+    partsKey += QLatin1Char(';');
+    collectStyleSheets(currentTheme);
 
-        QJsonParseError err;
-        QJsonDocument doc = QJsonDocument::fromJson(data, &err);
-        if (err.error != QJsonParseError::NoError || !doc.isObject()) {
-            continue;
+    // Different ratios or ids may end up with the same texts
+    auto partsIt = styleSheetParts.constFind(partsKey);
+    if (partsIt != styleSheetParts.constEnd()) {
+        styleSheetResults.insert(cacheKey, partsIt.value());
+        return partsIt.value();
+    }
+
+    QString stylesheets;
+    for (int i = 0; i < parts.size(); ++i) {
+        stylesheets += parts.at(i) + QStringLiteral("\n\n");
+        if (i == commonCount - 1) {
+            stylesheets += QStringLiteral("\n\n");
         }
+    }
+
+    // Subscribers with the same style sheet share one string even if their ids or themes differ
+    auto poolIt = styleSheetPool.constFind(stylesheets);
+    if (poolIt == styleSheetPool.constEnd()) {
+        poolIt = styleSheetPool.insert(stylesheets);
+    }
 
-        double ratio = 1;
-        double priority = 1;
+    styleSheetParts.insert(partsKey, *poolIt);
+    styleSheetResults.insert(cacheKey, *poolIt);
+    return *poolIt;
+}
 
-        auto objDoc = doc.object();
+/*!
+    \internal
 
-        QJsonValue value;
+    Returns the theme and the themes it inherits through the \c _base variable, the most basic
+    theme comes first.
+*/
+QMChronoSet<QString> QMDecoratorV2Private::resolveBaseThemes(
+    const QHash<QString, QHash<QString, QString>> &variables, const QString &theme) {
+    QString base = theme;
+    QMChronoSet<QString> bases{base};
+    while (!(base = variables.value(base).value(QStringLiteral("_base"))).isEmpty() &&
+           !bases.contains(base) // Avoid recursively referenced
+    ) {
+        bases.prepend(base);
+    }
+    return bases;
+}
 
-        // Get default values
-        value = objDoc.value(QStringLiteral("config"));
-        if (!value.isUndefined() && value.isObject()) {
-            auto obj = value.toObject();
-            value = obj.value(QStringLiteral("ratio"));
-            if (!value.isUndefined()) {
-                auto _tmp = parsePlatformDouble(value);
-                if (_tmp > 0)
-                    ratio = _tmp;
+void QMDecoratorV2Private::scanForThemes() const {
+    QElapsedTimer timer;
+    timer.start();
+    scanStatistics = {};
+
+    // Bundles containing the packages
+    auto collectBundles = [](const QVector<QMThemePackage> &packages, QSet<QString> *res) {
+        for (const auto &package : packages) {
+            if (auto bundle = QMThemeBundle::find(package.fileName, nullptr)) {
+                res->insert(bundle->fileName);
             }
+        }
+    };
+
+    // Drop the packages of removed paths
+    QSet<QString> droppedBundles;
+    for (auto it = themePackages.begin(); it != themePackages.end();) {
+        if (!themePaths.contains(it.key())) {
+            collectBundles(it.value(), &droppedBundles);
+            it = themePackages.erase(it);
+            continue;
+        }
+        ++it;
+    }
+
+    QStringList paths;
+    for (const auto &path : themePaths) {
+        if (!themePackages.contains(path)) {
+            paths.append(path);
+        }
+    }
+    scanThemePaths(paths);
 
-            value = obj.value(QStringLiteral("priority"));
-            if (!value.isUndefined()) {
-                auto _tmp = parsePlatformDouble(value, -1);
-                if (_tmp >= 0)
-                    priority = _tmp;
+    // Unmap the bundles that no path uses, the style sheets are copied when they're read
+    if (!droppedBundles.isEmpty()) {
+        QSet<QString> usedBundles;
+        for (const auto &packages : qAsConst(themePackages)) {
+            collectBundles(packages, &usedBundles);
+        }
+        for (const auto &fileName : qAsConst(droppedBundles)) {
+            if (!usedBundles.contains(fileName)) {
+                QMThemeBundle::close(fileName);
             }
         }
+    }
 
-        value = objDoc.value(QStringLiteral("variables"));
-        if (!value.isUndefined() && value.isObject()) {
-            auto obj = value.toObject();
-            for (auto it0 = obj.begin(); it0 != obj.end(); ++it0) {
-                if (!it0->isObject()) {
-                    continue;
-                }
-                auto themeObj = it0->toObject();
-                if (themeObj.isEmpty()) {
-                    continue;
-                }
+    QElapsedTimer mergeTimer;
+    mergeTimer.start();
+    mergeThemes();
+    scanStatistics.mergeTime = elapsedMicroseconds(mergeTimer);
+
+    themeFilesDirty = false;
+    updateThemeWatcher();
+
+    auto &stats = scanStatistics;
+    stats.totalTime = elapsedMicroseconds(timer);
+    qCDebug(qThemeLog).nospace() << "scan: " << stats.pathCount << " paths ("
+                                 << stats.cachedPathCount << " cached, "
+                                 << stats.compiledPathCount << " precompiled), " << stats.fileCount
+                                 << " files, " << stats.styleSheetCount << " style sheets, "
+                                 << stats.bytesRead << " bytes; search " << stats.searchTime
+                                 << "us, parse " << stats.parseTime << "us, style sheets "
+                                 << stats.styleSheetTime << "us, save " << stats.cacheSaveTime
+                                 << "us, merge " << stats.mergeTime << "us, total "
+                                 << stats.totalTime << "us";
+}
 
-                const auto &themeKey = it0.key();
-                auto &priorityMap = variablesPriorities[themeKey];
-                auto &variableMap = variables[themeKey];
+/*!
+    \internal
 
-                for (auto it = themeObj.begin(); it != themeObj.end(); ++it) {
-                    const auto &key = it.key();
-                    QString val;
-                    double _priority = priority;
+    Loads the packages of the given paths into \c themePackages, the compiled caches are used
+    when they are up to date.
+*/
+void QMDecoratorV2Private::scanThemePaths(const QStringList &paths) const {
+    struct PathData {
+        QString path;
+        QFileInfoList files;
+        QString cacheFile;
+        QVector<QMThemePackage> packages;
+    };
 
-                    if (it->isObject()) {
-                        auto varObj = it->toObject();
-                        value = varObj.value(QStringLiteral("priority"));
-                        if (value.isDouble()) {
-                            priority = value.toDouble();
-                        }
-                        value = varObj.value(QStringLiteral("value"));
-                        if (value.isString()) {
-                            val = value.toString();
-                        }
-                    } else if (it->isString()) {
-                        val = it->toString();
-                    }
+    auto &stats = scanStatistics;
+    stats.pathCount += paths.size();
 
-                    auto it2 = priorityMap.find(key);
-                    if (it2 == priorityMap.end()) {
-                        priorityMap.insert(key, _priority);
-                        variableMap[key] = val;
-                    } else if (it2.value() > _priority) {
-                        it2.value() = _priority;
-                        variableMap[key] = val;
-                    }
-                }
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<PathData> pending;
+    for (const auto &path : paths) {
+        PathData data{path, QMThemePackage::searchFiles(path), {}, {}};
+
+        // Try the themes precompiled at build time, the theme files may not be shipped
+        QMThemeCache compiled;
+        if (compiled.loadCompiled(path, data.files)) {
+            themePackages.insert(path, std::move(compiled.packages));
+            stats.compiledPathCount++;
+            continue;
+        }
+
+        // Try the compiled cache, only the file stamps need to be checked
+        if (!themeCacheDir.isEmpty()) {
+            data.cacheFile = QMThemeCache::cacheFileName(themeCacheDir, path);
+
+            QMThemeCache cache;
+            if (cache.load(data.cacheFile) && cache.isUpToDate(path, data.files)) {
+                themePackages.insert(path, std::move(cache.packages));
+                stats.cachedPathCount++;
+                continue;
             }
         }
+        pending.append(data);
+    }
+    stats.searchTime += elapsedMicroseconds(timer);
 
-        auto parseStyleObject = [&](QMap<QString, QMap<double, QList<QssItem>>> &map,
-                                    const QString &key, const QJsonObject &obj) {
-            QssItem item{ratio, {}, {}};
-            QJsonValue value;
+    if (pending.isEmpty()) {
+        return;
+    }
+    timer.restart();
+
+    // Parse packages of all paths on the thread pool
+    QVector<QPair<PathData *, int>> jobs;
+    for (auto &data : pending) {
+        data.packages.resize(data.files.size());
+        for (int i = 0; i < data.files.size(); ++i) {
+            jobs.append(qMakePair(&data, i));
+            stats.bytesRead += data.files.at(i).size();
+        }
+    }
+    stats.fileCount += jobs.size();
 
-            value = obj.value(QStringLiteral("file"));
-            if (!value.isUndefined()) {
-                QString fileName = parsePlatformString(value);
-                if (!fileName.isEmpty()) {
-                    if (QDir::isRelativePath(fileName)) {
-                        fileName = file.absolutePath() + QStringLiteral("/") + fileName;
-                    }
-                    item.fileName = fileName;
-                    goto out;
+    QVector<char> valid(jobs.size());
+    {
+        auto jobData = jobs.constData();
+        auto validData = valid.data();
+        QMPrivate::parallelFor(jobs.size(), [&](int i) {
+            auto data = jobData[i].first;
+            int index = jobData[i].second;
+            validData[i] = data->packages[index].load(data->files.at(index).absoluteFilePath());
+        });
+    }
+
+    QVector<QMThemePackage::QssItem *> items;
+    {
+        int i = 0;
+        for (auto &data : pending) {
+            QVector<QMThemePackage> packages;
+            for (auto &package : data.packages) {
+                if (valid.at(i++)) {
+                    packages.append(std::move(package));
                 }
             }
+            data.packages = std::move(packages);
 
-            value = obj.value(QStringLiteral("content"));
-            if (!value.isUndefined()) {
-                QString content = parsePlatformString(value);
-                if (!content.isEmpty()) {
-                    item.content = content;
-                    goto out;
-                }
+            if (data.cacheFile.isEmpty()) {
+                continue;
+            }
+            for (auto &package : data.packages) {
+                items += package.items().toVector();
             }
+        }
+    }
 
-            return;
+    stats.parseTime += elapsedMicroseconds(timer);
+    timer.restart();
+
+    // The contents are read when the themes are loaded, unless they're written to the caches
+    {
+        auto itemData = items.constData();
+        QMPrivate::parallelFor(items.size(), [&](int i) { itemData[i]->readStyleSheet(); });
+    }
 
-        out:
-            value = obj.value(QStringLiteral("ratio"));
-            if (!value.isUndefined()) {
-                auto _tmp = parsePlatformDouble(value);
-                if (_tmp > 0)
-                    item.ratio = _tmp;
+    for (const auto &item : qAsConst(items)) {
+        if (!item->fileName.isEmpty()) {
+            stats.styleSheetCount++;
+            stats.bytesRead += item->stamp.size;
+        }
+    }
+    stats.styleSheetTime += elapsedMicroseconds(timer);
+    timer.restart();
+
+    for (auto &data : pending) {
+        if (!data.cacheFile.isEmpty()) {
+            QMThemeCache cache;
+            cache.path = data.path;
+            for (const auto &file : qAsConst(data.files)) {
+                cache.sources.append(QMThemeFileStamp::fromFileInfo(file));
             }
+            cache.packages = data.packages;
+            if (!cache.save(data.cacheFile)) {
+                qCWarning(qAppExtLog) << "failed to write theme cache" << data.cacheFile;
+            }
+        }
+        themePackages.insert(data.path, std::move(data.packages));
+    }
+    stats.cacheSaveTime += elapsedMicroseconds(timer);
+}
 
-            auto _priority = priority;
+/*!
+    \internal
 
-            value = obj.value(QStringLiteral("priority"));
-            if (!value.isUndefined()) {
-                auto _tmp = parsePlatformDouble(value, -1);
-                if (_tmp >= 0)
-                    _priority = _tmp;
-            }
+    Rebuilds the stylesheets, namespace mappings and variables from the loaded packages.
+*/
+void QMDecoratorV2Private::mergeThemes() const {
+    themeGeneration++;
 
-            map[key][_priority].append(item);
-        };
+    // The icon files may have been changed along with the theme files
+    QMAppExtensionPrivate::globalIconCacheSerialNum++;
 
-        // Get namespaces
-        value = objDoc.value(QStringLiteral("widgets"));
-        if (!value.isUndefined() && value.isObject()) {
-            auto obj = value.toObject();
-            for (auto it = obj.begin(); it != obj.end(); ++it) {
-                QStringList keys;
-                if (it->isArray()) {
-                    for (const auto &item : it->toArray()) {
-                        if (item.isString())
-                            keys.append(item.toString());
-                    }
-                } else if (it->isString()) {
-                    keys.append(it->toString());
-                }
-                nsMappings[it.key()].append(keys);
-            }
+    stylesheetItems.clear();
+    flattenedThemes.clear();
+    nsMappings.clear();
+    variables.clear();
+
+    // theme - [ namespace - [ priority - items] ]
+    QMap<QString, QMap<QString, QMap<double, QssItemList>>> tmp;
+
+    QHash<QString, QHash<QString, double>> variablesPriorities;
+    for (const auto &path : themePaths) {
+        auto packagesIt = themePackages.find(path);
+        if (packagesIt == themePackages.end()) {
+            continue;
         }
 
-        value = objDoc.value(QStringLiteral("stylesheets"));
-        if (!value.isUndefined() && value.isObject()) {
-            auto obj = value.toObject();
-            for (auto it = obj.begin(); it != obj.end(); ++it) {
-                if (!it->isObject()) {
-                    continue;
+        // The items are referenced until the packages are scanned again
+        for (auto &package : packagesIt.value()) {
+            for (const auto &var : qAsConst(package.variables)) {
+                auto &priorityMap = variablesPriorities[var.themeKey];
+                auto &variableMap = variables[var.themeKey];
+
+                auto it2 = priorityMap.find(var.key);
+                if (it2 == priorityMap.end()) {
+                    priorityMap.insert(var.key, var.priority);
+                    variableMap[var.key] = var.value;
+                } else if (it2.value() > var.priority) {
+                    it2.value() = var.priority;
+                    variableMap[var.key] = var.value;
                 }
+            }
 
-                const QString &themeKey = it.key();
-                auto themeObj = it->toObject();
-
-                // namespace - [ priority - items ]
-                QMap<QString, QMap<double, QList<QssItem>>> map;
-                for (auto it1 = themeObj.begin(); it1 != themeObj.end(); ++it1) {
-                    if (it1->isArray()) {
-                        for (const auto &item : it1->toArray()) {
-                            if (item.isObject()) {
-                                parseStyleObject(map, it1.key(), item.toObject());
-                            }
-                        }
-                    } else if (it1->isObject()) {
-                        parseStyleObject(map, it1.key(), it1->toObject());
-                    }
-                }
+            for (const auto &pair : qAsConst(package.nsMappings)) {
+                nsMappings[pair.first].append(pair.second);
+            }
 
-                if (map.isEmpty()) {
-                    continue;
-                }
+            for (auto &pair : package.stylesheets) {
+                auto &map = pair.second;
 
-                auto &themeMap = tmp[themeKey];
+                auto &themeMap = tmp[pair.first];
                 for (auto it1 = map.begin(); it1 != map.end(); ++it1) {
-                    const auto &itemMap = it1.value();
+                    auto &itemMap = it1.value();
                     if (itemMap.isEmpty()) {
                         continue;
                     }
 
                     auto &nsMap = themeMap[it1.key()];
                     for (auto it2 = itemMap.begin(); it2 != itemMap.end(); ++it2) {
-                        if (it2->isEmpty()) {
-                            continue;
+                        auto &list = nsMap[it2.key()];
+                        for (auto &item : it2.value()) {
+                            list.append(&item);
                         }
-                        nsMap[it2.key()].append(it2.value());
                     }
                 }
             }
         }
     }
 
-    // Get stylesheet contents
-    auto readStyleSheets = [](const QMap<double, QList<QssItem>> &map) {
-        QString res;
-        for (auto it = --map.end(); it != --map.begin(); it--) {
-            for (const auto &item : qAsConst(it.value())) {
-                QString content;
-                if (!item.fileName.isEmpty()) {
-                    QFile f(item.fileName);
-                    if (!f.open(QIODevice::ReadOnly)) {
-                        continue;
-                    }
-                    content = QString::fromUtf8(f.readAll());
-
-                    // Replace relative paths
-                    QFileInfo info(item.fileName);
-                    content.replace(QRegularExpression(QStringLiteral(R"(@[/\\])")),
-                                    info.absolutePath() + QStringLiteral("/"));
-                    f.close();
-                } else {
-                    content = item.content;
-                }
-
-                if (content.isEmpty()) {
-                    continue;
-                }
-
-                res.append(QMDecoratorV2::evaluateStyleSheet(content, item.ratio) +
-                           QStringLiteral("\n\n"));
-            }
-        }
-
-        return res;
-    };
-
+    // The items of higher priority values come first
     for (auto it = tmp.begin(); it != tmp.end(); ++it) {
         const auto &themeKey = it.key();
         const auto &themeMap = it.value();
 
-        QMap<QString, QString> styleMap;
+        QMap<QString, QssItemList> styleMap;
         for (auto it2 = themeMap.begin(); it2 != themeMap.end(); ++it2) {
-            styleMap.insert(it2.key(), readStyleSheets(it2.value()));
+            QssItemList items;
+            for (auto it3 = it2->end(); it3 != it2->begin();) {
+                --it3;
+                items += it3.value();
+            }
+            styleMap.insert(it2.key(), items);
         }
 
         if (styleMap.isEmpty()) {
             continue;
         }
 
-        stylesheetCaches.insert(themeKey, styleMap);
+        stylesheetItems.insert(themeKey, styleMap);
     }
 
-    themeFilesDirty = false;
+    flattenThemes();
+
+    // The loaded themes stay in use, the contents that are kept don't need to be read again
+    for (auto it = loadedThemes.begin(); it != loadedThemes.end();) {
+        if (!flattenedThemes.contains(*it)) {
+            it = loadedThemes.erase(it);
+            continue;
+        }
+        ++it;
+    }
 }
 
-QString QMDecoratorV2Private::replaceFontSizes(const QString &stylesheet, double ratio,
-                                               bool rounding) {
-    static QRegularExpression re(QStringLiteral(R"(font-size\s*:\s*([0-9]+(\.[0-9]+|)px)\s*;)"));
-    QRegularExpressionMatch match;
-    int index = 0;
-    int lastIndex = 0;
-    QString result;
-    result.reserve(stylesheet.size());
-    while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
-        result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
-
-        auto matchString = match.capturedView(1);
-        double size = matchString.mid(0, matchString.size() - 2).toDouble();
-        size *= ratio;
-        QString valueString = QStringLiteral("font-size: ") +
-                              (rounding ? QString::number(int(size)) : QString::number(size)) +
-                              QStringLiteral("px;");
-        result += valueString;
-        index += match.captured().size();
-        lastIndex = index;
-    }
-    result += QStringView(stylesheet).mid(lastIndex);
-    return result;
-}
-
-QString QMDecoratorV2Private::replaceSizes(const QString &stylesheet, double ratio, bool rounding) {
-    static QRegularExpression re(QStringLiteral(R"([0-9]+(\.[0-9]+|)px)"));
-
-    QRegularExpressionMatch match;
-    int index = 0;
-    int lastIndex = 0;
-    QString result;
-    result.reserve(stylesheet.size());
-    while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
-        result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
-
-        auto matchString = match.capturedView();
-        double size = QStringView(matchString).mid(0, matchString.size() - 2).toDouble();
-        size *= ratio;
-        QString valueString =
-            (rounding ? QString::number(int(size)) : QString::number(size)) + QStringLiteral("px");
-
-        result += valueString;
-        index += matchString.size();
-        lastIndex = index;
-    }
-    result += QStringView(stylesheet).mid(lastIndex);
-    return result;
-}
-
-QString QMDecoratorV2Private::replaceCustomKeyWithQProperty(const QString &stylesheet) {
-    // Replace "--key: value;" with "qproperty-key: value;"
-    // Replace "---key: value;" with "key: value;"
-    static QRegularExpression re(QStringLiteral(R"((\{|;|^)\s*(--|---)\w(\w|-)*:)"),
-                                 QRegularExpression::MultilineOption |
-                                     QRegularExpression::DotMatchesEverythingOption);
-    QRegularExpressionMatch match;
-    int index = 0;
-    int lastIndex = 0;
-    QString result;
-    result.reserve(stylesheet.size());
-    while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
-        result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
-
-        auto matchString = match.capturedView();
-        auto capturedIndex = match.capturedStart(2) - index;
-        auto capturedLen = match.capturedLength(2);
-        auto valueString = matchString.toString();
-        valueString.replace(capturedIndex, capturedLen,
-                            capturedLen == 2 ? QStringLiteral("qproperty-") : "");
-
-        result += valueString;
-        index += matchString.size();
-        lastIndex = index;
-    }
-    result += QStringView(stylesheet).mid(lastIndex);
-    return result;
-}
-
-QString QMDecoratorV2Private::replaceCssGrammars(const QString &stylesheet) {
-    QString result;
-    result.reserve(stylesheet.size());
-
-    // Replace ":not(:xxx)" with ":!xxx"
-    {
-        static QRegularExpression re(QStringLiteral(R"(:not\(\s*:([^)]+)\s*\))"),
-                                     QRegularExpression::MultilineOption |
-                                         QRegularExpression::DotMatchesEverythingOption);
-        QRegularExpressionMatch match;
-        int index = 0;
-        int lastIndex = 0;
-        while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
-            result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
+/*!
+    \internal
 
-            QString matchString = match.captured();
-            QString valueString = QStringLiteral(":!") + match.captured(1).trimmed();
-            result += valueString;
-            index += matchString.size();
-            lastIndex = index;
-        }
-        result += QStringView(stylesheet).mid(lastIndex);
+    Resolves the base themes of all themes, so that the refresh of a subscriber only looks up
+    the namespaces once and doesn't walk the inheritance chains.
+*/
+void QMDecoratorV2Private::flattenThemes() const {
+    QSet<QString> themeKeys;
+    for (auto it = stylesheetItems.begin(); it != stylesheetItems.end(); ++it) {
+        themeKeys.insert(it.key());
+    }
+    for (auto it = variables.begin(); it != variables.end(); ++it) {
+        themeKeys.insert(it.key());
     }
 
-    // Replace "svg(...);" to "url(\"[[...]].svgx\");"
-    {
-        static QRegularExpression re(QStringLiteral(R"(svg\((.*?)\)(;|\s*\}))"),
-                                     QRegularExpression::MultilineOption |
-                                         QRegularExpression::DotMatchesEverythingOption);
-        result.replace(re, QStringLiteral(R"(url("[[\1]].svgx")\2)"));
+    // The references in the variables are expanded once for each theme
+    QHash<QString, QMVariableTable> tables;
+    for (auto it = variables.begin(); it != variables.end(); ++it) {
+        auto table = QMVariableTable::resolve(it.value());
+        for (const auto &cycle : qAsConst(table.cycles)) {
+            qCWarning(qThemeLog).noquote()
+                << "theme" << it.key() << "has cyclic variable references:" << cycle;
+        }
+        tables.insert(it.key(), std::move(table));
     }
-    return result;
-}
 
-QString QMDecoratorV2Private::removeAllComments(const QString &stylesheet) {
-    static QRegularExpression re(QStringLiteral(R"(\/\*(.*?)\*\/)"),
-                                 QRegularExpression::MultilineOption |
-                                     QRegularExpression::DotMatchesEverythingOption);
-    QRegularExpressionMatch match;
-    int index = 0;
-    int lastIndex = 0;
-    QString result;
-    result.reserve(stylesheet.size());
-    while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
-        result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
+    for (const auto &themeKey : qAsConst(themeKeys)) {
+        FlattenedTheme theme;
 
-        index += match.captured(0).size();
-        lastIndex = index;
-    }
-    result += QStringView(stylesheet).mid(lastIndex);
-    return result;
-}
+        const auto &bases = resolveBaseThemes(variables, themeKey);
+        for (const auto &base : bases) {
+            theme.bases.append(base);
+        }
 
-void QMDecoratorV2Private::_q_themeSubscriberDestroyed() {
-    auto it = themeSubscribers.find(static_cast<QWidget *>(sender()));
-    if (it == themeSubscribers.end()) {
-        return;
+        for (int i = 0; i < theme.bases.size(); ++i) {
+            const auto &base = theme.bases.at(i);
+
+            // The variables of the derived themes take precedence
+            const auto &baseVariables = variables.value(base);
+            for (auto it = baseVariables.begin(); it != baseVariables.end(); ++it) {
+                theme.variables.insert(it.key(), it.value());
+            }
+
+            // The style sheets of a base theme are evaluated with its own variables
+            const auto &table = tables.value(base);
+            const auto &map = stylesheetItems.value(base);
+            for (auto it = map.begin(); it != map.end(); ++it) {
+                auto &sources = theme.namespaces[it.key()].sources;
+                sources.resize(theme.bases.size());
+                sources[i] = qMakePair(it.value(), table);
+            }
+        }
+
+        flattenedThemes.insert(themeKey, theme);
     }
-    delete it.value();
-    themeSubscribers.erase(it);
 }
 
 /*!
-    \class QMDecoratorV2
+    \internal
 
-    The QMDecoratorV2 class provides a theme registry and style sheet manager. It is usually
-    created when QMAppExtension initializes, so you should not manually create it.
+    Reads the style sheets of the theme and its base themes that haven't been read, and marks
+    the theme as the most recently used one.
 */
+void QMDecoratorV2Private::loadTheme(const QString &theme) const {
+    auto themeIt = flattenedThemes.find(theme);
+    if (themeIt == flattenedThemes.end()) {
+        return;
+    }
 
-/*!
-    Constructor.
-*/
-QMDecoratorV2::QMDecoratorV2(QObject *parent) : QMDecoratorV2(*new QMDecoratorV2Private(), parent) {
-}
+    loadedThemes.remove(theme);
+    loadedThemes.append(theme);
+    if (themeIt->loaded) {
+        return;
+    }
 
-/*!
-    Destructor.
-*/
-QMDecoratorV2::~QMDecoratorV2() {
-}
+    QElapsedTimer timer;
+    timer.start();
 
-/*!
-    Expands all QtMediate extension syntax in the given string and returns the standard Qt
-    StyleSheet.
+    QssItemList items;
+    for (const auto &base : qAsConst(themeIt->bases)) {
+        const auto &map = stylesheetItems.value(base);
+        for (const auto &list : map) {
+            for (const auto &item : list) {
+                if (!item->loaded) {
+                    items.append(item);
+                }
+            }
+        }
+    }
+
+    // Read and preprocess stylesheets on the thread pool
+    {
+        auto itemData = items.constData();
+        QMPrivate::parallelFor(items.size(), [&](int i) { itemData[i]->readStyleSheet(); });
+    }
+    themeIt->loaded = true;
+
+    auto &stats = scanStatistics;
+    for (const auto &item : qAsConst(items)) {
+        if (!item->fileName.isEmpty()) {
+            stats.styleSheetCount++;
+            stats.bytesRead += item->stamp.size;
+        }
+    }
+
+    const qint64 elapsed = elapsedMicroseconds(timer);
+    stats.styleSheetTime += elapsed;
+    qCDebug(qThemeLog).nospace() << "load " << theme << ": " << items.size()
+                                 << " style sheets, " << elapsed << "us";
+
+    unloadThemes();
+}
+
+/*!
+    \internal
+
+    Unloads the least recently used themes when there are more inactive themes loaded than the
+    limit, and releases the contents that are used by neither the active nor the loaded themes.
 */
-QString QMDecoratorV2::evaluateStyleSheet(const QString &stylesheet, double ratio,
-                                          double fontRatio) {
-    QString content = stylesheet;
+void QMDecoratorV2Private::unloadThemes() const {
+    const QString commonTheme = QStringLiteral("_common");
+    auto isActive = [&](const QString &theme) {
+        return theme == commonTheme || theme == currentTheme;
+    };
+
+    int inactiveCount = 0;
+    for (const auto &theme : loadedThemes) {
+        if (!isActive(theme)) {
+            inactiveCount++;
+        }
+    }
 
-    // Remove comments
-    content = QMDecoratorV2Private::removeAllComments(content);
+    for (auto it = loadedThemes.begin();
+         it != loadedThemes.end() && inactiveCount > inactiveThemeLimit;) {
+        if (isActive(*it)) {
+            ++it;
+            continue;
+        }
 
-    // Replace custom keys
-    content = QMDecoratorV2Private::replaceCustomKeyWithQProperty(content);
+        auto themeIt = flattenedThemes.find(*it);
+        if (themeIt != flattenedThemes.end()) {
+            themeIt->loaded = false;
+            for (auto &ns : themeIt->namespaces) {
+                ns.templates.clear();
+                ns.formatted.clear();
+            }
+        }
 
-    // Replace CSS grammars
-    content = QMDecoratorV2Private::replaceCssGrammars(content);
+        // The results of the other themes are kept, see themeStyleSheet()
+        const QString resultPrefix = *it + QChar(QChar::Null);
+        for (auto resultIt = styleSheetResults.begin(); resultIt != styleSheetResults.end();) {
+            if (resultIt.key().startsWith(resultPrefix)) {
+                resultIt = styleSheetResults.erase(resultIt);
+                continue;
+            }
+            ++resultIt;
+        }
+        it = loadedThemes.erase(it);
+        inactiveCount--;
+    }
 
-    // Replace font sizes
-    if (fontRatio != 1 && fontRatio > 0) {
-        content = QMDecoratorV2Private::replaceFontSizes(content, fontRatio, false);
+    // The base themes share the contents with the derived themes
+    QSet<QString> usedThemes;
+    auto addBases = [&](const QString &theme) {
+        auto themeIt = flattenedThemes.constFind(theme);
+        if (themeIt == flattenedThemes.constEnd()) {
+            return;
+        }
+        for (const auto &base : themeIt->bases) {
+            usedThemes.insert(base);
+        }
+    };
+    addBases(commonTheme);
+    addBases(currentTheme);
+    for (const auto &theme : loadedThemes) {
+        addBases(theme);
     }
 
-    // Replace pixel sizes
-    if (ratio != 1 && ratio > 0) {
-        content = QMDecoratorV2Private::replaceSizes(content, ratio, false);
+    for (auto it = stylesheetItems.begin(); it != stylesheetItems.end(); ++it) {
+        if (usedThemes.contains(it.key())) {
+            continue;
+        }
+        for (const auto &list : it.value()) {
+            for (const auto &item : list) {
+                if (item->loaded && !item->pinned) {
+                    item->loaded = false;
+                    item->result = QString();
+                }
+            }
+        }
     }
-    return content;
 }
 
 /*!
-    Adds a directory to the searching paths, you may need to call refreshTheme() to reload
-    subscribers' states.
+    \internal
+
+    Rescans the theme paths after a path is added or removed, only the subscribers whose style
+    sheets may be affected are updated.
+*/
+void QMDecoratorV2Private::reloadThemes() {
+    const auto oldItems = stylesheetItems;
+    const auto oldNsMappings = nsMappings;
+    const auto oldVariables = variables;
+    const auto oldPaths = themePackages.keys();
+
+    scanForThemes();
+
+    // The items of the new paths may take the addresses of the destroyed ones
+    QSet<const QMThemePackage::QssItem *> newItems;
+    for (auto it = themePackages.begin(); it != themePackages.end(); ++it) {
+        if (oldPaths.contains(it.key())) {
+            continue;
+        }
+        for (auto &package : it.value()) {
+            for (const auto &item : package.items()) {
+                newItems.insert(item);
+            }
+        }
+    }
+    auto hasNewItems = [&](const QssItemList &items) {
+        for (const auto &item : items) {
+            if (newItems.contains(item)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Variables and base themes affect all namespaces of a theme
+    bool updateAll = false;
+    QSet<QString> changedThemes;
+    for (const auto &theme : {QStringLiteral("_common"), currentTheme}) {
+        const auto &bases = resolveBaseThemes(variables, theme);
+        if (bases != resolveBaseThemes(oldVariables, theme)) {
+            updateAll = true;
+            break;
+        }
+        for (const auto &base : bases) {
+            if (oldVariables.value(base) != variables.value(base)) {
+                updateAll = true;
+            }
+            changedThemes.insert(base);
+        }
+    }
+
+    QSet<QString> changedIds;
+    QSet<QString> changedNamespaces;
+    if (!updateAll) {
+        for (const auto &theme : qAsConst(changedThemes)) {
+            const auto &oldMap = oldItems.value(theme);
+            const auto &map = stylesheetItems.value(theme);
+            for (auto it = map.begin(); it != map.end(); ++it) {
+                if (oldMap.value(it.key()) != it.value() || hasNewItems(it.value())) {
+                    changedNamespaces.insert(it.key());
+                }
+            }
+            for (auto it = oldMap.begin(); it != oldMap.end(); ++it) {
+                if (!map.contains(it.key())) {
+                    changedNamespaces.insert(it.key());
+                }
+            }
+        }
+
+        for (auto it = nsMappings.begin(); it != nsMappings.end(); ++it) {
+            if (oldNsMappings.value(it.key()) != it.value()) {
+                changedIds.insert(it.key());
+            }
+        }
+        for (auto it = oldNsMappings.begin(); it != oldNsMappings.end(); ++it) {
+            if (!nsMappings.contains(it.key())) {
+                changedIds.insert(it.key());
+            }
+        }
+    }
+
+    auto isAffected = [&](const QMDecoratorThemeGuardV2 *item) {
+        if (updateAll) {
+            return true;
+        }
+        for (const auto &id : item->ids) {
+            if (changedIds.contains(id)) {
+                return true;
+            }
+            for (const auto &ns : nsMappings.value(id)) {
+                if (changedNamespaces.contains(ns)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+
+    QList<QMDecoratorThemeGuardV2 *> affected;
+    for (const auto &item : qAsConst(themeSubscribers)) {
+        if (isAffected(item)) {
+            affected.append(item);
+        }
+    }
+    refreshSubscribers(affected, false);
+}
+
+/*!
+    \internal
+
+    Watches the directories of the theme paths, the package files, the style sheet files that
+    the packages refer to and the svg files in the theme paths. The bundles are not watched
+    since they stay mapped.
+*/
+void QMDecoratorV2Private::updateThemeWatcher() const {
+    if (!themeWatcher) {
+        return;
+    }
+
+    QSet<QString> paths;
+    themeSourceStamps.clear();
+    iconFileStamps.clear();
+    for (const auto &path : themePaths) {
+        if (QMThemeBundle::isBundleFile(path)) {
+            continue;
+        }
+
+        // Package files are added or removed in any subdirectory
+        const QString dir = QDir(path).absolutePath();
+        paths.insert(dir);
+        QDirIterator it(dir, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            paths.insert(it.next());
+        }
+
+        auto &stamps = themeSourceStamps[path];
+        for (const auto &file : QMThemePackage::searchFiles(path)) {
+            stamps.append(QMThemeFileStamp::fromFileInfo(file));
+            paths.insert(file.absoluteFilePath());
+        }
+
+        // The icon engines read the svg files by themselves
+        QDirIterator iconIt(dir, {QStringLiteral("*.svg")}, QDir::Files,
+                            QDirIterator::Subdirectories);
+        while (iconIt.hasNext()) {
+            const QString fileName = iconIt.next();
+            iconFileStamps.insert(fileName, QMThemeFileStamp::fromFileName(fileName));
+            paths.insert(fileName);
+        }
+    }
+
+    for (const auto &map : qAsConst(stylesheetItems)) {
+        for (const auto &list : map) {
+            for (const auto &item : list) {
+                if (!item->fileName.isEmpty() && !item->pinned) {
+                    paths.insert(QFileInfo(item->fileName).absoluteFilePath());
+                }
+            }
+        }
+    }
+
+    // The entries of the bundles and the removed files can't be watched
+    QStringList removed;
+    for (const auto &path : themeWatcher->files() + themeWatcher->directories()) {
+        if (!paths.remove(path)) {
+            removed.append(path);
+        }
+    }
+    QStringList added;
+    for (const auto &path : qAsConst(paths)) {
+        if (QFileInfo::exists(path)) {
+            added.append(path);
+        }
+    }
+
+    if (!removed.isEmpty()) {
+        themeWatcher->removePaths(removed);
+    }
+    if (!added.isEmpty()) {
+        themeWatcher->addPaths(added);
+    }
+}
+
+/*!
+    \internal
+
+    Handles the theme files changed since the watch timer started. The loaded style sheets whose
+    files changed are read again and only their namespaces are evaluated again, while a theme
+    path whose package files changed is scanned again. The changed svg files make the icons
+    render again.
+*/
+void QMDecoratorV2Private::reloadChangedThemeFiles() {
+    const auto files = std::move(changedThemeFiles);
+    const auto dirs = std::move(changedThemeDirs);
+    changedThemeFiles.clear();
+    changedThemeDirs.clear();
+
+    // Scanned on the next use anyway
+    if (themeFilesDirty) {
+        return;
+    }
+
+    auto isChanged = [&](const QString &fileName) {
+        // Editors usually save by replacing the file, which changes the directory
+        const QFileInfo info(fileName);
+        return files.contains(info.absoluteFilePath()) || dirs.contains(info.absolutePath());
+    };
+
+    QStringList dirtyPaths;
+    for (const auto &path : themePaths) {
+        auto stampsIt = themeSourceStamps.constFind(path);
+        if (stampsIt == themeSourceStamps.constEnd()) {
+            continue;
+        }
+
+        const QString dir = QDir(path).absolutePath();
+        auto isInPath = [&](const QString &changed) {
+            return changed == dir || changed.startsWith(dir + QLatin1Char('/'));
+        };
+        if (std::none_of(files.begin(), files.end(), isInPath) &&
+            std::none_of(dirs.begin(), dirs.end(), isInPath)) {
+            continue;
+        }
+
+        QList<QMThemeFileStamp> stamps;
+        for (const auto &file : QMThemePackage::searchFiles(path)) {
+            stamps.append(QMThemeFileStamp::fromFileInfo(file));
+        }
+        if (stamps != stampsIt.value()) {
+            dirtyPaths.append(path);
+        }
+    }
+
+    // The icon engines read the svg files again when the serial num changes, the cached pixmaps
+    // are not used either
+    for (auto it = iconFileStamps.cbegin(); it != iconFileStamps.cend(); ++it) {
+        if (isChanged(it.key()) && !it->isUpToDate()) {
+            QMAppExtensionPrivate::globalIconCacheSerialNum++;
+            for (const auto &item : qAsConst(themeSubscribers)) {
+                item->w->update();
+            }
+            break;
+        }
+    }
+
+    // theme - namespaces whose style sheet files changed, the items that aren't loaded are read
+    // when their themes are loaded
+    QHash<QString, QSet<QString>> changedNamespaces;
+    QSet<QMThemePackage::QssItem *> items;
+    for (auto it = stylesheetItems.begin(); it != stylesheetItems.end(); ++it) {
+        for (auto it2 = it->begin(); it2 != it->end(); ++it2) {
+            for (const auto &item : it2.value()) {
+                if (!item->loaded || item->pinned || item->fileName.isEmpty() ||
+                    !isChanged(item->fileName) ||
+                    item->stamp.isUpToDate()) {
+                    continue;
+                }
+                items.insert(item);
+                changedNamespaces[it.key()].insert(it2.key());
+            }
+        }
+    }
+
+    if (!items.isEmpty()) {
+        QElapsedTimer timer;
+        timer.start();
+
+        const QssItemList list(items.begin(), items.end());
+        for (const auto &item : list) {
+            item->loaded = false;
+            item->result = QString();
+        }
+        {
+            auto itemData = list.constData();
+            QMPrivate::parallelFor(list.size(), [&](int i) { itemData[i]->readStyleSheet(); });
+        }
+
+        // The namespaces are evaluated again on next use in all themes based on the changed ones
+        QSet<QString> activeNamespaces;
+        for (auto it = flattenedThemes.begin(); it != flattenedThemes.end(); ++it) {
+            const bool active = it.key() == QStringLiteral("_common") || it.key() == currentTheme;
+            for (const auto &base : qAsConst(it->bases)) {
+                const auto &namespaces = changedNamespaces.value(base);
+                for (const auto &key : namespaces) {
+                    auto nsIt = it->namespaces.find(key);
+                    if (nsIt == it->namespaces.end()) {
+                        continue;
+                    }
+                    nsIt->templates.clear();
+                    nsIt->formatted.clear();
+                    if (active) {
+                        activeNamespaces.insert(key);
+                    }
+                }
+            }
+        }
+        themeGeneration++;
+
+        qCDebug(qThemeLog).nospace() << "reload: " << list.size() << " style sheets, "
+                                     << elapsedMicroseconds(timer) << "us";
+
+        auto isAffected = [&](const QMDecoratorThemeGuardV2 *item) {
+            for (const auto &id : item->ids) {
+                for (const auto &ns : nsMappings.value(id)) {
+                    if (activeNamespaces.contains(ns)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        };
+
+        QList<QMDecoratorThemeGuardV2 *> affected;
+        for (const auto &item : qAsConst(themeSubscribers)) {
+            if (isAffected(item)) {
+                affected.append(item);
+            }
+        }
+        refreshSubscribers(affected, false);
+    }
+
+    // The packages of the other paths are kept
+    if (!dirtyPaths.isEmpty()) {
+        for (const auto &path : qAsConst(dirtyPaths)) {
+            themePackages.remove(path);
+        }
+        reloadThemes();
+    } else {
+        // The replaced files need to be watched again
+        updateThemeWatcher();
+    }
+}
+
+/*!
+    \internal
+
+    Returns the ratio that the sizes are scaled by on the screen.
+*/
+double QMDecoratorV2Private::screenRatio(QScreen *screen) const {
+#ifdef AUTO_SYNC_WITH_DPI
+    auto it = screenRatios.constFind(screen);
+    if (it == screenRatios.constEnd()) {
+        it = screenRatios.insert(screen, screen->logicalDotsPerInch() / QM::unitDpi());
+    }
+    return it.value();
+#else
+    Q_UNUSED(screen)
+    return 1.0;
+#endif
+}
+
+/*!
+    \internal
+
+    Moves the subscriber to the new screen in the screen registry, the DPI of a screen is watched
+    by the decorator once no matter how many subscribers are on it.
+*/
+void QMDecoratorV2Private::moveScreenSubscriber(QMDecoratorThemeGuardV2 *guard, QScreen *from,
+                                               QScreen *to) {
+    if (from) {
+        auto it = screenSubscribers.find(from);
+        if (it != screenSubscribers.end()) {
+            it->remove(guard);
+        }
+    }
+    if (!to) {
+        return;
+    }
+
+    auto it = screenSubscribers.find(to);
+    if (it == screenSubscribers.end()) {
+        it = screenSubscribers.insert(to, {});
+#ifdef AUTO_SYNC_WITH_DPI
+        connect(to, &QScreen::logicalDotsPerInchChanged, this,
+                &QMDecoratorV2Private::_q_logicalDotsPerInchChanged);
+#endif
+        connect(to, &QObject::destroyed, this, &QMDecoratorV2Private::_q_screenDestroyed);
+    }
+    it->insert(guard);
+}
+
+void QMDecoratorV2Private::_q_logicalDotsPerInchChanged() {
+    auto screen = static_cast<QScreen *>(sender());
+    screenRatios.remove(screen);
+
+    const auto &guards = screenSubscribers.value(screen);
+    refreshSubscribers(QList<QMDecoratorThemeGuardV2 *>(guards.begin(), guards.end()), false);
+}
+
+void QMDecoratorV2Private::_q_screenDestroyed() {
+    // The subscribers will be moved to other screens when their windows are
+    auto screen = static_cast<QScreen *>(sender());
+    screenSubscribers.remove(screen);
+    screenRatios.remove(screen);
+}
+
+void QMDecoratorV2Private::_q_themeFileChanged(const QString &path) {
+    changedThemeFiles.insert(path);
+    themeWatchTimer->start();
+}
+
+void QMDecoratorV2Private::_q_themeDirectoryChanged(const QString &path) {
+    changedThemeDirs.insert(path);
+    themeWatchTimer->start();
+}
+
+// Time spent restyling in one event loop iteration
+static const int RefreshSliceBudget = 16;
+
+/*!
+    \internal
+
+    Restyles the given subscribers without blocking the event loop for long. The visible widgets
+    of the active window are processed first and the other visible widgets follow in later
+    slices, while the hidden widgets are restyled when they are shown.
+
+    If \a notify is true, \c themeChanged is emitted when all visible widgets are restyled.
+*/
+void QMDecoratorV2Private::refreshSubscribers(const QList<QMDecoratorThemeGuardV2 *> &guards,
+                                              bool notify) {
+    // Statistics cover the whole refresh if it's extended before finishing
+    if (!refreshTimer.isValid()) {
+        refreshStatistics = {};
+        refreshTimer.start();
+    }
+    refreshStatistics.widgetCount += guards.size();
+
+    const QWidget *activeWindow = QApplication::activeWindow();
+
+    QList<QMDecoratorThemeGuardV2 *> active;
+    QList<QMDecoratorThemeGuardV2 *> inactive;
+    QSet<QMDecoratorThemeGuardV2 *> visited;
+    auto enqueue = [&](QMDecoratorThemeGuardV2 *item) {
+        if (visited.contains(item)) {
+            return;
+        }
+        visited.insert(item);
+
+        if (!item->w->isVisible()) {
+            item->needUpdate = true;
+            refreshStatistics.deferredCount++;
+            return;
+        }
+        (item->w->window() == activeWindow ? active : inactive).append(item);
+    };
+
+    // Subscribers left by the previous refresh
+    for (const auto &item : qAsConst(refreshQueue)) {
+        enqueue(item);
+    }
+    for (const auto &item : guards) {
+        enqueue(item);
+    }
+
+    refreshQueue = active + inactive;
+    notifyAfterRefresh = notifyAfterRefresh || notify;
+
+    // The first slice runs immediately so that the active window is updated without delay
+    refreshNextSlice();
+}
+
+void QMDecoratorV2Private::refreshNextSlice() {
+    refreshStatistics.sliceCount++;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!refreshQueue.isEmpty()) {
+        refreshQueue.takeFirst()->updateScreen();
+        if (timer.elapsed() >= RefreshSliceBudget) {
+            break;
+        }
+    }
+
+    if (!refreshQueue.isEmpty()) {
+        if (!hasPendingRefreshSlice) {
+            hasPendingRefreshSlice = true;
+            QTimer::singleShot(0, this, [this]() {
+                hasPendingRefreshSlice = false;
+
+                // The refresh may have been finished by a later one
+                if (refreshTimer.isValid()) {
+                    refreshNextSlice();
+                }
+            });
+        }
+        return;
+    }
+
+    const auto &stats = refreshStatistics;
+    refreshStatistics.totalTime = elapsedMicroseconds(refreshTimer);
+    refreshTimer.invalidate();
+    qCDebug(qThemeLog).nospace() << "refresh: " << stats.widgetCount << " widgets ("
+                                 << stats.restyledCount << " restyled, " << stats.unchangedCount
+                                 << " unchanged, " << stats.deferredCount << " deferred), "
+                                 << stats.sliceCount << " slices, " << stats.cacheHitCount
+                                 << " cache hits, " << stats.templateCount << " templates, "
+                                 << stats.formatCount << " formats; evaluate "
+                                 << stats.evaluateTime << "us, apply " << stats.applyTime
+                                 << "us, total " << stats.totalTime << "us";
+
+    if (notifyAfterRefresh) {
+        notifyAfterRefresh = false;
+
+        Q_Q(QMDecoratorV2);
+        Q_EMIT q->themeChanged(currentTheme);
+    }
+}
+
+void QMDecoratorV2Private::_q_themeSubscriberDestroyed() {
+    auto it = themeSubscribers.find(static_cast<QWidget *>(sender()));
+    if (it == themeSubscribers.end()) {
+        return;
+    }
+    if (!refreshQueue.isEmpty()) {
+        refreshQueue.removeOne(it.value());
+    }
+    moveScreenSubscriber(it.value(), it.value()->screen, nullptr);
+    delete it.value();
+    themeSubscribers.erase(it);
+}
+
+/*!
+    \class QMDecoratorV2
+
+    The QMDecoratorV2 class provides a theme registry and style sheet manager. It is usually
+    created when QMAppExtension initializes, so you should not manually create it.
+*/
+
+/*!
+    Constructor.
+*/
+QMDecoratorV2::QMDecoratorV2(QObject *parent) : QMDecoratorV2(*new QMDecoratorV2Private(), parent) {
+}
+
+/*!
+    Destructor.
+*/
+QMDecoratorV2::~QMDecoratorV2() {
+}
+
+/*!
+    Expands all QtMediate extension syntax in the given string and returns the standard Qt
+    StyleSheet.
+*/
+QString QMDecoratorV2::evaluateStyleSheet(const QString &stylesheet, double ratio,
+                                          double fontRatio) {
+    return QMPrivate::rewriteStyleSheet(stylesheet, ratio, fontRatio);
+}
+
+/*!
+    Returns the statistics of the last time the theme paths were scanned.
+
+    \sa lastRefreshStatistics()
+*/
+QMDecoratorV2::ScanStatistics QMDecoratorV2::lastScanStatistics() const {
+    Q_D(const QMDecoratorV2);
+    return d->scanStatistics;
+}
+
+/*!
+    Returns the statistics of the last time the theme subscribers were refreshed, the
+    statistics of a refresh in progress are not complete.
+
+    The statistics are also written to the \c qtmediate.theme logging category at the debug
+    level.
+*/
+QMDecoratorV2::RefreshStatistics QMDecoratorV2::lastRefreshStatistics() const {
+    Q_D(const QMDecoratorV2);
+    return d->refreshStatistics;
+}
+
+/*!
+    Adds a directory to the searching paths. The paths added earlier take precedence when the
+    variables of the same priority are defined in several paths.
+
+    The path can also be a theme bundle (\c *.qmtb) built by the \c qmthemepack tool, the
+    bundles found in the directories are loaded as well. The files in a bundle are read from a
+    memory mapping, which is released when no theme path uses the bundle. The images that the
+    style sheets in a bundle refer to with \c url() are extracted to a temporary directory,
+    since Qt reads them by the file names.
+
+    If there are theme subscribers, only the new directory is scanned and the subscribers whose
+    style sheets are affected are reloaded, otherwise the directory is scanned on the next use.
 */
 void QMDecoratorV2::addThemePath(const QString &path) {
     Q_D(QMDecoratorV2);
@@ -757,13 +1447,19 @@ void QMDecoratorV2::addThemePath(const QString &path) {
     if (d->themePaths.contains(path))
         return;
 
-    d->themePaths.insert(path);
-    d->themeFilesDirty = true;
+    d->themePaths.append(path);
+
+    // Scan lazily until the themes are in use
+    if (d->themeFilesDirty || d->themeSubscribers.isEmpty()) {
+        d->themeFilesDirty = true;
+        return;
+    }
+    d->reloadThemes();
 }
 
 /*!
-    Removes a directory from the searching paths, you may need to call refreshTheme() to reload
-    subscribers' states.
+    Removes a directory from the searching paths, the subscribers whose style sheets are affected
+    are reloaded.
 */
 void QMDecoratorV2::removeThemePath(const QString &path) {
     Q_D(QMDecoratorV2);
@@ -775,12 +1471,110 @@ void QMDecoratorV2::removeThemePath(const QString &path) {
     if (canonicalPath.isEmpty())
         return;
 
-    auto it = d->themePaths.find(path);
-    if (it == d->themePaths.end())
+    if (!d->themePaths.remove(path))
+        return;
+
+    if (d->themeFilesDirty || d->themeSubscribers.isEmpty()) {
+        d->themeFilesDirty = true;
+        return;
+    }
+    d->reloadThemes();
+}
+
+/*!
+    Returns the directory where the compiled theme caches are stored.
+*/
+QString QMDecoratorV2::themeCacheDirectory() const {
+    Q_D(const QMDecoratorV2);
+    return d->themeCacheDir;
+}
+
+/*!
+    Sets the directory where the compiled theme caches are stored, an empty string disables the
+    cache.
+
+    When the cache is enabled, the result of scanning the theme paths is written to the directory
+    and is reused as long as none of the theme files has been changed, so that the JSON files and
+    style sheets don't need to be parsed again on the next startup.
+*/
+void QMDecoratorV2::setThemeCacheDirectory(const QString &dir) {
+    Q_D(QMDecoratorV2);
+    d->themeCacheDir = dir;
+}
+
+/*!
+    Returns the maximum number of inactive themes whose style sheets stay in memory.
+*/
+int QMDecoratorV2::inactiveThemeLimit() const {
+    Q_D(const QMDecoratorV2);
+    return d->inactiveThemeLimit;
+}
+
+/*!
+    Sets the maximum number of inactive themes whose style sheets stay in memory, the default
+    value is 1.
+
+    The style sheets of a theme are read when the theme is used for the first time. When the
+    theme is switched, the previous theme stays loaded so that switching back is fast, and the
+    least recently used themes beyond the limit are unloaded.
+*/
+void QMDecoratorV2::setInactiveThemeLimit(int count) {
+    Q_D(QMDecoratorV2);
+    count = qMax(0, count);
+    if (d->inactiveThemeLimit == count)
+        return;
+    d->inactiveThemeLimit = count;
+    d->unloadThemes();
+}
+
+/*!
+    Returns true if the theme files are watched.
+*/
+bool QMDecoratorV2::isThemeWatchEnabled() const {
+    Q_D(const QMDecoratorV2);
+    return d->themeWatcher != nullptr;
+}
+
+/*!
+    Sets whether the theme files are watched, which is disabled by default and is intended for
+    developing themes.
+
+    When a style sheet file changes, only the file is read again and the subscribers using its
+    namespaces are restyled. When a package file is changed, added or removed, the theme path
+    containing it is scanned again. The changes are handled together after a short delay, since
+    saving a file usually emits several notifications. The theme bundles are not watched.
+*/
+void QMDecoratorV2::setThemeWatchEnabled(bool enabled) {
+    Q_D(QMDecoratorV2);
+    if (isThemeWatchEnabled() == enabled)
+        return;
+
+    if (!enabled) {
+        delete d->themeWatcher;
+        delete d->themeWatchTimer;
+        d->themeWatcher = nullptr;
+        d->themeWatchTimer = nullptr;
+        d->changedThemeFiles.clear();
+        d->changedThemeDirs.clear();
+        d->themeSourceStamps.clear();
         return;
+    }
+
+    d->themeWatcher = new QFileSystemWatcher(d);
+    connect(d->themeWatcher, &QFileSystemWatcher::fileChanged, d,
+            &QMDecoratorV2Private::_q_themeFileChanged);
+    connect(d->themeWatcher, &QFileSystemWatcher::directoryChanged, d,
+            &QMDecoratorV2Private::_q_themeDirectoryChanged);
 
-    d->themePaths.erase(it);
-    d->themeFilesDirty = true;
+    d->themeWatchTimer = new QTimer(d);
+    d->themeWatchTimer->setSingleShot(true);
+    d->themeWatchTimer->setInterval(ThemeWatchDelay);
+    connect(d->themeWatchTimer, &QTimer::timeout, d,
+            &QMDecoratorV2Private::reloadChangedThemeFiles);
+
+    if (!d->themeFilesDirty) {
+        d->updateThemeWatcher();
+    }
 }
 
 /*!
@@ -791,7 +1585,7 @@ QStringList QMDecoratorV2::themes() const {
     if (d->themeFilesDirty) {
         d->scanForThemes();
     }
-    QStringList res = d->stylesheetCaches.keys();
+    QStringList res = d->stylesheetItems.keys();
     res.removeOne(QStringLiteral("_common"));
     return res;
 }
@@ -806,6 +1600,10 @@ QString QMDecoratorV2::theme() const {
 
 /*!
     Sets the current theme.
+
+    The visible widgets of the active window are restyled immediately, the other visible widgets
+    are restyled in the following event loop iterations, and the hidden widgets are restyled when
+    they are shown. The \c themeChanged signal is emitted after all visible widgets are updated.
 */
 void QMDecoratorV2::setTheme(const QString &theme) {
     Q_D(QMDecoratorV2);
@@ -816,18 +1614,25 @@ void QMDecoratorV2::setTheme(const QString &theme) {
         d->scanForThemes();
     } else if (d->themeArgsDirty) {
         d->themeArgsDirty = false;
+
+        // Only the ratios change, the evaluated style sheets remain valid
+        if (d->currentTheme == theme) {
+            d->refreshSubscribers(d->themeSubscribers.values(), true);
+            return;
+        }
     } else if (d->currentTheme == theme) {
         return;
     }
 
-    d->currentTheme = theme;
-    // QMDecoratorV2Private::globalImageCacheSerialNum++;
-    QPixmapCache::clear(); // Clear icon caches
-
-    for (const auto &item : qAsConst(d->themeSubscribers)) {
-        item->updateScreen();
+    // The previous theme becomes the most recently used inactive theme
+    if (d->loadedThemes.remove(d->currentTheme)) {
+        d->loadedThemes.append(d->currentTheme);
     }
-    Q_EMIT themeChanged(theme);
+
+    // The results are keyed by the theme, the ones of the previous theme stay valid
+    d->currentTheme = theme;
+    d->unloadThemes();
+    d->refreshSubscribers(d->themeSubscribers.values(), true);
 }
 
 /*!
@@ -848,11 +1653,12 @@ void QMDecoratorV2::deferRefreshTheme() {
 }
 
 /*!
-    Returns the value defined in current theme configuration that is the mapping of the key.
+    Returns the value defined in current theme configuration that is the mapping of the key, the
+    values of the base themes are used if the current theme doesn't define it.
 */
 QString QMDecoratorV2::themeVariable(const QString &key) const {
     Q_D(const QMDecoratorV2);
-    return d->variables.value(d->currentTheme, {}).value(key);
+    return d->flattenedThemes.value(d->currentTheme).variables.value(key);
 }
 
 double QMDecoratorV2::fontRatio() const {
@@ -24,10 +24,55 @@ public:
     static QString evaluateStyleSheet(const QString &stylesheet, double ratio = 1,
                                       double fontRatio = 1);
 
+    struct ScanStatistics {
+        int pathCount = 0;         // Scanned theme paths
+        int cachedPathCount = 0;   // Paths loaded from the compiled caches
+        int compiledPathCount = 0; // Paths loaded from the themes precompiled at build time
+        int fileCount = 0;         // Parsed theme configuration files
+        int styleSheetCount = 0;   // Read style sheet files, including the themes loaded later
+        qint64 bytesRead = 0;
+
+        // Microseconds
+        qint64 searchTime = 0;     // Searching files and loading the compiled caches
+        qint64 parseTime = 0;      // Parsing theme configuration files
+        qint64 styleSheetTime = 0; // Reading and rewriting style sheets
+        qint64 cacheSaveTime = 0;  // Writing the compiled caches
+        qint64 mergeTime = 0;      // Merging packages into themes
+        qint64 totalTime = 0;
+    };
+
+    struct RefreshStatistics {
+        int widgetCount = 0;    // Subscribers to refresh
+        int restyledCount = 0;  // Subscribers whose style sheets are set
+        int unchangedCount = 0; // Subscribers whose style sheets are the same
+        int deferredCount = 0;  // Hidden subscribers, restyled when shown
+        int sliceCount = 0;     // Event loop iterations
+        int cacheHitCount = 0;  // Style sheets found in the evaluated results
+        int templateCount = 0;  // Namespaces whose variables are evaluated
+        int formatCount = 0;    // Namespaces scaled to sizes not formatted before
+
+        // Microseconds
+        qint64 evaluateTime = 0; // Building style sheets
+        qint64 applyTime = 0;    // QWidget::setStyleSheet, including the polish of Qt
+        qint64 totalTime = 0;    // From the start to the last visible subscriber
+    };
+
+    ScanStatistics lastScanStatistics() const;
+    RefreshStatistics lastRefreshStatistics() const;
+
 public:
     void addThemePath(const QString &path);
     void removeThemePath(const QString &path);
 
+    QString themeCacheDirectory() const;
+    void setThemeCacheDirectory(const QString &dir);
+
+    int inactiveThemeLimit() const;
+    void setInactiveThemeLimit(int count);
+
+    bool isThemeWatchEnabled() const;
+    void setThemeWatchEnabled(bool enabled);
+
     void installTheme(QWidget *w, const QString &id);
 
 public:
@@ -10,16 +10,25 @@
 // version without notice, or may even be removed.
 //
 
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
 #include <QHash>
+#include <QLoggingCategory>
 #include <QMap>
 #include <QPointer>
 #include <QSet>
 #include <QTranslator>
 #include <QWidget>
 
+#include <QMCore/qmchronoset.h>
 #include <QMCore/private/qmcoredecoratorv2_p.h>
 #include <QMWidgets/qmdecoratorv2.h>
 
+#include "qmstylesheetrewriter_p.h"
+#include "qmthemepackage_p.h"
+
+Q_DECLARE_LOGGING_CATEGORY(qThemeLog)
+
 class QMDecoratorThemeGuardV2;
 
 class QMDecoratorV2Private : public QMCoreDecoratorV2Private {
@@ -31,32 +40,120 @@ public:
     void init();
 
     void scanForThemes() const;
+    void scanThemePaths(const QStringList &paths) const;
+    void mergeThemes() const;
+    void flattenThemes() const;
+    void reloadThemes();
+
+    void loadTheme(const QString &theme) const;
+    void unloadThemes() const;
+
+    void updateThemeWatcher() const;
+    void reloadChangedThemeFiles();
+
+    QString themeStyleSheet(const QStringList &ids, double ratio) const;
+
+    void refreshSubscribers(const QList<QMDecoratorThemeGuardV2 *> &guards, bool notify);
+    void refreshNextSlice();
 
-    QSet<QString> themePaths;
+    double screenRatio(QScreen *screen) const;
+    void moveScreenSubscriber(QMDecoratorThemeGuardV2 *guard, QScreen *from, QScreen *to);
+
+    static QMChronoSet<QString>
+        resolveBaseThemes(const QHash<QString, QHash<QString, QString>> &variables,
+                          const QString &theme);
+
+    QMChronoSet<QString> themePaths;
     QHash<QWidget *, QMDecoratorThemeGuardV2 *> themeSubscribers;
     QString currentTheme;
     double fontRatio;
     double zoomRatio;
+    QString themeCacheDir;
 
     mutable bool themeFilesDirty;
     mutable bool themeArgsDirty;
-    mutable QMap<QString, QMap<QString, QString>>
-        stylesheetCaches;                                      // themeKey - [ namespace - content ]
     mutable QHash<QString, QStringList> nsMappings;            // widgetKey - namespaces
     mutable QHash<QString, QHash<QString, QString>> variables; // themeKey - [ varKey - var ]
 
-    // static int globalImageCacheSerialNum;
+    using QssItemList = QVector<QMThemePackage::QssItem *>;
+
+    // themeKey - [ namespace - items ], the items of higher priority values come first, the
+    // contents are read when a theme using them is loaded
+    mutable QMap<QString, QMap<QString, QssItemList>> stylesheetItems;
+
+    // path - packages, merged into the above in the order of the theme paths
+    mutable QHash<QString, QVector<QMThemePackage>> themePackages;
+
+    // Loaded themes, the least recently used comes first
+    mutable QMChronoSet<QString> loadedThemes;
+    int inactiveThemeLimit;
 
-    static QString replaceFontSizes(const QString &stylesheet, double ratio, bool rounding);
-    static QString replaceSizes(const QString &stylesheet, double ratio, bool rounding);
-    static QString replaceCustomKeyWithQProperty(const QString &stylesheet);
-    static QString replaceCssGrammars(const QString &stylesheet);
-    static QString removeAllComments(const QString &stylesheet);
+    struct FlattenedNamespace {
+        // [ items - variables ] of each base theme, empty if the base doesn't define it
+        QVector<QPair<QssItemList, QMVariableTable>> sources;
+
+        // Built on first use, the variables are evaluated and the sizes are ready to be scaled
+        QVector<QMStyleSheetTemplate> templates;
+
+        struct Formatted {
+            QVector<double> sizes; // QMStyleSheetTemplate::scaledSizes() of the text
+            QString text;
+            quint64 serial;
+        };
+
+        // Recently formatted texts of each template, the latest comes first
+        QVector<QVector<Formatted>> formatted;
+    };
+
+    struct FlattenedTheme {
+        QStringList bases; // The farthest base comes first
+        QHash<QString, QString> variables; // With the values of the base themes
+        QHash<QString, FlattenedNamespace> namespaces;
+        bool loaded = false; // The contents of the items are read
+    };
+
+    // themeKey - theme with the base themes resolved
+    mutable QHash<QString, FlattenedTheme> flattenedThemes;
+
+    // Increased whenever the evaluated style sheets may change
+    mutable int themeGeneration;
+
+    // [ theme, ids, ratio, fontRatio ] - evaluated style sheet
+    mutable QHash<QString, QString> styleSheetResults;
+    mutable QHash<QString, QString> styleSheetParts; // serials of the formatted texts - result
+    mutable QSet<QString> styleSheetPool;            // distinct results
+    mutable int styleSheetResultsGeneration;
+    mutable quint64 formattedSerial;
 
     bool hasPendingRefreshTask;
 
+    // Visible subscribers waiting to be restyled, the active window comes first
+    QList<QMDecoratorThemeGuardV2 *> refreshQueue;
+    bool hasPendingRefreshSlice;
+    bool notifyAfterRefresh;
+
+    mutable QMDecoratorV2::ScanStatistics scanStatistics;
+    mutable QMDecoratorV2::RefreshStatistics refreshStatistics;
+    QElapsedTimer refreshTimer; // Valid while a refresh is in progress
+
+    // Created while the theme files are watched, the changes are handled after the timer
+    QFileSystemWatcher *themeWatcher;
+    QTimer *themeWatchTimer;
+    QSet<QString> changedThemeFiles;
+    QSet<QString> changedThemeDirs;
+    mutable QHash<QString, QList<QMThemeFileStamp>> themeSourceStamps; // path - package files
+    mutable QHash<QString, QMThemeFileStamp> iconFileStamps; // svg files in the theme paths
+
+    // screen - subscribers on the screen
+    QHash<QScreen *, QSet<QMDecoratorThemeGuardV2 *>> screenSubscribers;
+    mutable QHash<QScreen *, double> screenRatios;
+
 private:
     void _q_themeSubscriberDestroyed();
+    void _q_logicalDotsPerInchChanged();
+    void _q_screenDestroyed();
+    void _q_themeFileChanged(const QString &path);
+    void _q_themeDirectoryChanged(const QString &path);
 };
 
 #endif // QMDECORATORV2_P_H
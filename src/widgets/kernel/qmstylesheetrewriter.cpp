@@ -0,0 +1,736 @@
+#include "qmstylesheetrewriter_p.h"
+
+#include <QStringView>
+
+// The scanners below reproduce the behavior of the regular expressions that were used before,
+// "\s" and "\w" of QRegularExpression only match ASCII characters by default.
+
+static inline bool isSpace(QChar c) {
+    const ushort u = c.unicode();
+    return u == ' ' || (u >= '\t' && u <= '\r');
+}
+
+static inline bool isDigit(QChar c) {
+    const ushort u = c.unicode();
+    return u >= '0' && u <= '9';
+}
+
+static inline bool isWord(QChar c) {
+    const ushort u = c.unicode();
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') ||
+           u == '_';
+}
+
+// Same as removing "\/\*(.*?)\*\/"
+static QString removeComments(const QString &s) {
+    QString res;
+    res.reserve(s.size());
+
+    int index = 0;
+    int begin;
+    while ((begin = s.indexOf(QLatin1String("/*"), index)) >= 0) {
+        int end = s.indexOf(QLatin1String("*/"), begin + 2);
+        if (end < 0) {
+            break;
+        }
+        res += QStringView(s).mid(index, begin - index);
+        index = end + 2;
+    }
+    res += QStringView(s).mid(index);
+    return res;
+}
+
+// Returns 2 for "--key:" and 3 for "---key:" at the index, otherwise returns 0
+static int customKeyPrefixLength(const QString &s, int i) {
+    const int n = s.size();
+    const QChar *data = s.constData();
+
+    int len;
+    if (i + 2 < n && data[i + 1] == QLatin1Char('-') && isWord(data[i + 2])) {
+        len = 2;
+    } else if (i + 3 < n && data[i + 1] == QLatin1Char('-') && data[i + 2] == QLatin1Char('-') &&
+               isWord(data[i + 3])) {
+        len = 3;
+    } else {
+        return 0;
+    }
+
+    int j = i + len + 1;
+    while (j < n && (isWord(data[j]) || data[j] == QLatin1Char('-'))) {
+        ++j;
+    }
+    return (j < n && data[j] == QLatin1Char(':')) ? len : 0;
+}
+
+// Replaces "--key:" with "qproperty-key:" and "---key:" with "key:" in the range, a key is only
+// recognized at the start of a line or after "{" or ";" and white spaces, which is tracked by
+// keyContext across the calls.
+static void appendCustomKeys(QString &out, const QString &s, int from, int to, bool &keyContext) {
+    const QChar *data = s.constData();
+
+    int index = from;
+    for (int i = from; i < to; ++i) {
+        const QChar c = data[i];
+        if (c == QLatin1Char('-') && keyContext) {
+            int len = customKeyPrefixLength(s, i);
+            if (len > 0) {
+                out.append(data + index, i - index);
+                if (len == 2) {
+                    out += QStringLiteral("qproperty-");
+                }
+                index = i + len;
+            }
+        }
+
+        if (c == QLatin1Char('\n') || c == QLatin1Char('{') || c == QLatin1Char(';')) {
+            keyContext = true;
+        } else if (!isSpace(c)) {
+            keyContext = false;
+        }
+    }
+    out.append(data + index, to - index);
+}
+
+// Matches ":not(:xxx)" at the index, returns the index of ")" or -1
+static int notSelectorEnd(const QString &s, int i, int *colon) {
+    const int n = s.size();
+    const QChar *data = s.constData();
+
+    int j = i + 5;
+    while (j < n && isSpace(data[j])) {
+        ++j;
+    }
+    if (j >= n || data[j] != QLatin1Char(':')) {
+        return -1;
+    }
+
+    int close = s.indexOf(QLatin1Char(')'), j + 1);
+    if (close < 0 || close == j + 1) {
+        return -1;
+    }
+    *colon = j;
+    return close;
+}
+
+// Rewrites custom keys and ":not(:xxx)" selectors
+static QString rewriteSelectors(const QString &s) {
+    QString res;
+    res.reserve(s.size() + s.size() / 8);
+
+    bool keyContext = true;
+    int index = 0;
+    int i = 0;
+    while ((i = s.indexOf(QLatin1String(":not("), i)) >= 0) {
+        int colon;
+        int close = notSelectorEnd(s, i, &colon);
+        if (close < 0) {
+            ++i;
+            continue;
+        }
+        appendCustomKeys(res, s, index, i, keyContext);
+
+        QString selector;
+        bool selectorKeyContext = false;
+        appendCustomKeys(selector, s, colon + 1, close, selectorKeyContext);
+        res += QStringLiteral(":!") + selector.trimmed();
+
+        keyContext = false;
+        index = i = close + 1;
+    }
+    appendCustomKeys(res, s, index, s.size(), keyContext);
+    return res;
+}
+
+// Matches "svg(...);" or "svg(...) }" at the index, returns the end of the match or -1
+static int svgFunctionEnd(const QString &s, int i, int *close) {
+    const int n = s.size();
+    const QChar *data = s.constData();
+
+    int j = i + 4;
+    int c;
+    while ((c = s.indexOf(QLatin1Char(')'), j)) >= 0) {
+        int k = c + 1;
+        if (k < n && data[k] == QLatin1Char(';')) {
+            *close = c;
+            return k + 1;
+        }
+        while (k < n && isSpace(data[k])) {
+            ++k;
+        }
+        if (k < n && data[k] == QLatin1Char('}')) {
+            *close = c;
+            return k + 1;
+        }
+        j = c + 1;
+    }
+    return -1;
+}
+
+// Matches "[0-9]+(\.[0-9]+|)px" at the index, returns the end of the match or -1 and sets next
+// to the end of the integer part, where the next attempt should start.
+static int pixelSizeEnd(const QChar *data, int i, int to, int *next) {
+    int j = i;
+    while (j < to && isDigit(data[j])) {
+        ++j;
+    }
+    if (j + 1 < to && data[j] == QLatin1Char('p') && data[j + 1] == QLatin1Char('x')) {
+        return j + 2;
+    }
+    if (j < to && data[j] == QLatin1Char('.')) {
+        int k = j + 1;
+        while (k < to && isDigit(data[k])) {
+            ++k;
+        }
+        if (k > j + 1 && k + 1 < to && data[k] == QLatin1Char('p') &&
+            data[k + 1] == QLatin1Char('x')) {
+            return k + 2;
+        }
+    }
+    *next = j;
+    return -1;
+}
+
+// Matches "font-size\s*:\s*([0-9]+(\.[0-9]+|)px)\s*;" at the index, returns the end of the match
+// or -1 and sets the range of the number
+static int fontSizeEnd(const QChar *data, int i, int to, int *numBegin, int *numEnd) {
+    int j = i + 9;
+    while (j < to && isSpace(data[j])) {
+        ++j;
+    }
+    if (j >= to || data[j] != QLatin1Char(':')) {
+        return -1;
+    }
+    ++j;
+    while (j < to && isSpace(data[j])) {
+        ++j;
+    }
+    if (j >= to || !isDigit(data[j])) {
+        return -1;
+    }
+
+    int next;
+    int k = pixelSizeEnd(data, j, to, &next);
+    if (k < 0) {
+        return -1;
+    }
+    *numBegin = j;
+    *numEnd = k - 2;
+
+    while (k < to && isSpace(data[k])) {
+        ++k;
+    }
+    if (k >= to || data[k] != QLatin1Char(';')) {
+        return -1;
+    }
+    return k + 1;
+}
+
+static inline QString pixelSizeText(double size, bool rounding) {
+    return (rounding ? QString::number(int(size)) : QString::number(size)) + QStringLiteral("px");
+}
+
+static inline QString fontSizeText(double size) {
+    return QStringLiteral("font-size: ") + QString::number(size) + QStringLiteral("px;");
+}
+
+// Scales all "Npx" in the range by the ratio
+static void appendPixelSizes(QString &out, const QChar *data, int from, int to, double ratio,
+                             bool rounding) {
+    int index = from;
+    int i = from;
+    while (i < to) {
+        if (!isDigit(data[i])) {
+            ++i;
+            continue;
+        }
+
+        int next;
+        int end = pixelSizeEnd(data, i, to, &next);
+        if (end < 0) {
+            i = next;
+            continue;
+        }
+        out.append(data + index, i - index);
+        out += pixelSizeText(QStringView(data + i, end - 2 - i).toDouble() * ratio, rounding);
+        index = i = end;
+    }
+    out.append(data + index, to - index);
+}
+
+namespace {
+
+    // Scales "font-size: Npx;" by the font ratio and then all "Npx" by the ratio
+    class SizeScaler {
+    public:
+        SizeScaler(const QString &s, double ratio, double fontRatio, bool rounding)
+            : s(s), ratio(ratio), fontRatio(fontRatio), rounding(rounding) {
+            scalePixels = ratio != 1 && ratio > 0;
+            scaleFonts = fontRatio != 1 && fontRatio > 0;
+            fontIndex = scaleFonts ? s.indexOf(QLatin1String("font-size")) : -1;
+        }
+
+        inline bool isActive() const {
+            return scalePixels || scaleFonts;
+        }
+
+        void append(QString &out, int from, int to) {
+            const QChar *data = s.constData();
+            if (!scaleFonts) {
+                appendPixels(out, data, from, to);
+                return;
+            }
+
+            int index = from;
+            int i = from;
+            while ((i = nextFontSize(i)) >= 0 && i + 9 <= to) {
+                int numBegin;
+                int numEnd;
+                int end = fontSizeEnd(data, i, to, &numBegin, &numEnd);
+                if (end < 0) {
+                    ++i;
+                    continue;
+                }
+                appendPixels(out, data, index, i);
+
+                double size = QStringView(data + numBegin, numEnd - numBegin).toDouble();
+                const QString text = fontSizeText(size * fontRatio);
+                appendPixels(out, text.constData(), 0, text.size());
+                index = i = end;
+            }
+            appendPixels(out, data, index, to);
+        }
+
+    private:
+        const QString &s;
+        double ratio;
+        double fontRatio;
+        bool rounding;
+
+        bool scalePixels;
+        bool scaleFonts;
+        int fontIndex; // Next "font-size", searched lazily
+
+        inline int nextFontSize(int from) {
+            if (fontIndex >= 0 && fontIndex < from) {
+                fontIndex = s.indexOf(QLatin1String("font-size"), from);
+            }
+            return fontIndex;
+        }
+
+        inline void appendPixels(QString &out, const QChar *data, int from, int to) const {
+            if (!scalePixels) {
+                out.append(data + from, to - from);
+                return;
+            }
+            appendPixelSizes(out, data, from, to, ratio, rounding);
+        }
+    };
+
+}
+
+namespace QMPrivate {
+
+    /*!
+        \internal
+
+        Expands the QtMediate extension syntax of the style sheet in linear scans, the result is
+        the same as applying the following replacements in order.
+
+        \li Removes comments.
+        \li Replaces \c --key: with \c qproperty-key: and \c ---key: with \c key: .
+        \li Replaces \c :not(:xxx) with \c :!xxx .
+        \li Replaces \c svg(...) with \c url("[[...]].svgx") .
+        \li Scales \c font-size: Npx; by \a fontRatio .
+        \li Scales \c Npx by \a ratio .
+    */
+    QString rewriteStyleSheet(const QString &stylesheet, double ratio, double fontRatio) {
+        QString content = stylesheet;
+        if (content.contains(QLatin1String("/*"))) {
+            content = removeComments(content);
+        }
+        if (content.contains(QLatin1String("--")) || content.contains(QLatin1String(":not("))) {
+            content = rewriteSelectors(content);
+        }
+
+        SizeScaler scaler(content, ratio, fontRatio, false);
+
+        QString res;
+        res.reserve(content.size() + content.size() / 8);
+
+        int index = 0;
+        int i = 0;
+        while ((i = content.indexOf(QLatin1String("svg("), i)) >= 0) {
+            int close;
+            int end = svgFunctionEnd(content, i, &close);
+            if (end < 0) {
+                // No later function can be closed either
+                break;
+            }
+            scaler.append(res, index, i);
+            res += QStringLiteral("url(\"[[");
+            scaler.append(res, i + 4, close);
+            res += QStringLiteral("]].svgx\")");
+            res += QStringView(content).mid(close + 1, end - close - 1);
+            index = i = end;
+        }
+        scaler.append(res, index, content.size());
+        return res;
+    }
+
+    /*!
+        \internal
+
+        Scales \c font-size: Npx; by \a fontRatio and then \c Npx by \a ratio in one scan.
+    */
+    QString scaleStyleSheetSizes(const QString &stylesheet, double ratio, double fontRatio,
+                                 bool rounding) {
+        SizeScaler scaler(stylesheet, ratio, fontRatio, rounding);
+        if (!scaler.isActive()) {
+            return stylesheet;
+        }
+
+        QString res;
+        res.reserve(stylesheet.size());
+        scaler.append(res, 0, stylesheet.size());
+        return res;
+    }
+
+}
+
+/*!
+    \class QMStyleSheetTemplate
+    \internal
+
+    The QMStyleSheetTemplate class holds a style sheet that has been scanned once, the parts
+    that depend on the theme variables or the ratios are recorded as placeholders so that the
+    text can be rebuilt without scanning it again.
+*/
+
+/*!
+    \internal
+
+    Records the <tt>${name}</tt> references of the style sheet, the same as what the first
+    round of \c QMSimpleVarExp::evaluate with the pattern <tt>[^\}]+</tt> matches.
+*/
+QMStyleSheetTemplate QMStyleSheetTemplate::fromVariables(const QString &stylesheet) {
+    QMStyleSheetTemplate res;
+    res.text = stylesheet;
+
+    const int n = stylesheet.size();
+    const QChar *data = stylesheet.constData();
+
+    int i = 0;
+    while ((i = stylesheet.indexOf(QLatin1Char('$'), i)) >= 0) {
+        // A reference starts at the first "$" of an odd run, "$$" is an escaped "$"
+        int j = i;
+        while (j < n && data[j] == QLatin1Char('$')) {
+            ++j;
+        }
+        if ((j - i) % 2 == 1 && j < n && data[j] == QLatin1Char('{')) {
+            int close = stylesheet.indexOf(QLatin1Char('}'), j + 1);
+            if (close > j + 1) {
+                res.placeholders.append({Variable, i, close + 1 - i, 0});
+                i = close + 1;
+                continue;
+            }
+        }
+        i = j;
+    }
+    return res;
+}
+
+/*!
+    \internal
+
+    Records the \c font-size: Npx; declarations and the \c Npx sizes of the style sheet.
+*/
+QMStyleSheetTemplate QMStyleSheetTemplate::fromSizes(const QString &stylesheet) {
+    QMStyleSheetTemplate res;
+    res.text = stylesheet;
+
+    const int n = stylesheet.size();
+    const QChar *data = stylesheet.constData();
+
+    auto addPixelSizes = [&](int from, int to) {
+        int i = from;
+        while (i < to) {
+            if (!isDigit(data[i])) {
+                ++i;
+                continue;
+            }
+
+            int next;
+            int end = pixelSizeEnd(data, i, to, &next);
+            if (end < 0) {
+                i = next;
+                continue;
+            }
+            double size = QStringView(data + i, end - 2 - i).toDouble();
+            res.placeholders.append({PixelSize, i, end - i, size});
+            i = end;
+        }
+    };
+
+    int index = 0;
+    int i = stylesheet.indexOf(QLatin1String("font-size"));
+    while (i >= 0) {
+        int numBegin;
+        int numEnd;
+        int end = fontSizeEnd(data, i, n, &numBegin, &numEnd);
+        if (end < 0) {
+            i = stylesheet.indexOf(QLatin1String("font-size"), i + 1);
+            continue;
+        }
+        addPixelSizes(index, i);
+
+        double size = QStringView(data + numBegin, numEnd - numBegin).toDouble();
+        res.placeholders.append({FontSize, i, end - i, size});
+        index = end;
+        i = stylesheet.indexOf(QLatin1String("font-size"), index);
+    }
+    addPixelSizes(index, n);
+    return res;
+}
+
+// Replaces the variable placeholders with the values, the unknown names are kept
+static QString substituteVariables(const QString &text,
+                                   const QVector<QMStyleSheetTemplate::Placeholder> &placeholders,
+                                   const QHash<QString, QString> &values) {
+    const QChar *data = text.constData();
+
+    QString res;
+    res.reserve(text.size());
+
+    int index = 0;
+    for (const auto &placeholder : placeholders) {
+        if (placeholder.type != QMStyleSheetTemplate::Variable) {
+            continue;
+        }
+        res.append(data + index, placeholder.begin - index);
+
+        // The name is enclosed by the first "{" and the last "}"
+        const int end = placeholder.begin + placeholder.length;
+        const int brace = text.indexOf(QLatin1Char('{'), placeholder.begin);
+        const QString name = text.mid(brace + 1, end - brace - 2);
+        auto it = values.find(name);
+        res += (it == values.end()) ? name : it.value();
+        index = end;
+    }
+    res.append(data + index, text.size() - index);
+    return res;
+}
+
+namespace {
+
+    class VariableResolver {
+    public:
+        VariableResolver(const QHash<QString, QString> &variables, QMVariableTable &table)
+            : variables(variables), table(table) {
+        }
+
+        // Resolves the variables that the value depends on first
+        void resolve(const QString &name) {
+            if (table.values.contains(name)) {
+                return;
+            }
+            stack.append(name);
+
+            const auto &tpl = QMStyleSheetTemplate::fromVariables(variables.value(name));
+            QHash<QString, QString> dependencies;
+            for (const auto &placeholder : qAsConst(tpl.placeholders)) {
+                const int end = placeholder.begin + placeholder.length;
+                const int brace = tpl.text.indexOf(QLatin1Char('{'), placeholder.begin);
+                const QString dep = tpl.text.mid(brace + 1, end - brace - 2);
+                if (!variables.contains(dep) || dependencies.contains(dep)) {
+                    continue;
+                }
+
+                // A reference back into the chain is kept as an unknown name
+                const int cycleBegin = stack.indexOf(dep);
+                if (cycleBegin >= 0) {
+                    const QStringList cycle = stack.mid(cycleBegin) << dep;
+                    table.cycles.append(cycle.join(QStringLiteral(" -> ")));
+                    continue;
+                }
+
+                resolve(dep);
+                dependencies.insert(dep, table.values.value(dep));
+            }
+
+            stack.removeLast();
+            table.values.insert(name,
+                                substituteVariables(tpl.text, tpl.placeholders, dependencies));
+        }
+
+    private:
+        const QHash<QString, QString> &variables;
+        QMVariableTable &table;
+        QStringList stack;
+    };
+
+}
+
+/*!
+    \class QMVariableTable
+    \internal
+
+    The QMVariableTable class holds the theme variables whose values have been expanded, so that
+    binding a style sheet only needs to replace each reference once.
+*/
+
+/*!
+    \internal
+
+    Expands the references in the values of the variables in dependency order. A reference that
+    leads back to a variable being expanded is recorded in \c cycles and is replaced by the name
+    as if it's unknown.
+*/
+QMVariableTable QMVariableTable::resolve(const QHash<QString, QString> &variables) {
+    QMVariableTable res;
+    res.values.reserve(variables.size());
+
+    VariableResolver resolver(variables, res);
+    for (auto it = variables.begin(); it != variables.end(); ++it) {
+        resolver.resolve(it.key());
+    }
+    return res;
+}
+
+/*!
+    \internal
+
+    Returns the text with the variables evaluated. For well-formed references the result is the
+    same as \c QMSimpleVarExp::evaluate with the pattern <tt>[^\}]+</tt>, but the references in
+    the values are expanded inside the values first, so a value like \c $ no longer escapes the
+    reference that follows it, and the cyclic references don't hang.
+*/
+QString QMStyleSheetTemplate::bind(const QHash<QString, QString> &variables) const {
+    return bind(QMVariableTable::resolve(variables));
+}
+
+/*!
+    \internal
+
+    Returns the text with the references replaced by the expanded values in one pass.
+*/
+QString QMStyleSheetTemplate::bind(const QMVariableTable &table) const {
+    QString res = substituteVariables(text, placeholders, table.values);
+
+    // A value may form a new reference with the text around it, e.g. "$" followed by "{name}",
+    // which is resolved in the following rounds as QMSimpleVarExp::evaluate does. The rounds are
+    // limited in case the references formed this way never end.
+    for (int round = 0; round < 16; ++round) {
+        const auto &tpl = fromVariables(res);
+        if (tpl.placeholders.isEmpty()) {
+            break;
+        }
+
+        QString next = substituteVariables(tpl.text, tpl.placeholders, table.values);
+        if (next == res) {
+            break;
+        }
+        res = std::move(next);
+    }
+
+    res.replace(QStringLiteral("$$"), QStringLiteral("$"));
+    return res;
+}
+
+/*!
+    \internal
+
+    Returns the sizes that format() writes for the ratios, preceded by the scaling mode. If the
+    sizes of two pairs of ratios are equal, format() returns the same text for them, so a
+    formatted text can be reused without building the string again.
+*/
+QVector<double> QMStyleSheetTemplate::scaledSizes(double ratio, double fontRatio,
+                                                  bool rounding) const {
+    const bool scalePixels = ratio != 1 && ratio > 0;
+    const bool scaleFonts = fontRatio != 1 && fontRatio > 0;
+
+    QVector<double> res;
+    res.append(int(scalePixels) | int(scaleFonts) << 1 | int(rounding) << 2);
+    if (!scalePixels && !scaleFonts) {
+        return res;
+    }
+
+    auto pixelSize = [&](double size) { return rounding ? int(size * ratio) : size * ratio; };
+
+    res.reserve(placeholders.size() + 1);
+    for (const auto &placeholder : placeholders) {
+        switch (placeholder.type) {
+            case PixelSize: {
+                res.append(scalePixels ? pixelSize(placeholder.value) : -1);
+                break;
+            }
+            case FontSize: {
+                if (!scalePixels) {
+                    res.append(placeholder.value * fontRatio);
+                    break;
+                }
+                // The scaled font size is written as text and then parsed as a pixel size
+                res.append(pixelSize(
+                    scaleFonts ? QString::number(placeholder.value * fontRatio).toDouble()
+                               : placeholder.value));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return res;
+}
+
+/*!
+    \internal
+
+    Returns the text with the size placeholders scaled, the result is the same as
+    \c QMPrivate::scaleStyleSheetSizes.
+*/
+QString QMStyleSheetTemplate::format(double ratio, double fontRatio, bool rounding) const {
+    const bool scalePixels = ratio != 1 && ratio > 0;
+    const bool scaleFonts = fontRatio != 1 && fontRatio > 0;
+    if (!scalePixels && !scaleFonts) {
+        return text;
+    }
+
+    const QChar *data = text.constData();
+
+    QString res;
+    res.reserve(text.size());
+
+    int index = 0;
+    for (const auto &placeholder : placeholders) {
+        res.append(data + index, placeholder.begin - index);
+
+        const QStringView original(data + placeholder.begin, placeholder.length);
+        switch (placeholder.type) {
+            case PixelSize: {
+                if (scalePixels) {
+                    res += pixelSizeText(placeholder.value * ratio, rounding);
+                } else {
+                    res += original;
+                }
+                break;
+            }
+            case FontSize: {
+                // The pixel size in the declaration is scaled as well
+                const QString declaration =
+                    scaleFonts ? fontSizeText(placeholder.value * fontRatio) : original.toString();
+                if (scalePixels) {
+                    appendPixelSizes(res, declaration.constData(), 0, declaration.size(), ratio,
+                                     rounding);
+                } else {
+                    res += declaration;
+                }
+                break;
+            }
+            default:
+                res += original;
+                break;
+        }
+        index = placeholder.begin + placeholder.length;
+    }
+    res.append(data + index, text.size() - index);
+    return res;
+}
@@ -0,0 +1,65 @@
+#ifndef QMSTYLESHEETREWRITER_P_H
+#define QMSTYLESHEETREWRITER_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <QMWidgets/qmwidgetsglobal.h>
+
+namespace QMPrivate {
+
+    QM_WIDGETS_EXPORT QString rewriteStyleSheet(const QString &stylesheet, double ratio,
+                                                double fontRatio);
+
+    QM_WIDGETS_EXPORT QString scaleStyleSheetSizes(const QString &stylesheet, double ratio,
+                                                   double fontRatio, bool rounding);
+
+}
+
+class QM_WIDGETS_EXPORT QMVariableTable {
+public:
+    QHash<QString, QString> values; // The references in the values are expanded
+    QStringList cycles;             // a -> b -> a
+
+    static QMVariableTable resolve(const QHash<QString, QString> &variables);
+};
+
+class QM_WIDGETS_EXPORT QMStyleSheetTemplate {
+public:
+    enum PlaceholderType {
+        Variable,  // ${name}
+        PixelSize, // Npx
+        FontSize,  // font-size: Npx;
+    };
+
+    struct Placeholder {
+        PlaceholderType type;
+        int begin;
+        int length;
+        double value; // Number of the size placeholders
+    };
+
+    QString text;
+    QVector<Placeholder> placeholders;
+
+    static QMStyleSheetTemplate fromVariables(const QString &stylesheet);
+    static QMStyleSheetTemplate fromSizes(const QString &stylesheet);
+
+    QString bind(const QHash<QString, QString> &variables) const;
+    QString bind(const QMVariableTable &table) const;
+    QString format(double ratio, double fontRatio, bool rounding) const;
+    QVector<double> scaledSizes(double ratio, double fontRatio, bool rounding) const;
+};
+
+#endif // QMSTYLESHEETREWRITER_P_H
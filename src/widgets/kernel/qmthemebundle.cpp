@@ -0,0 +1,403 @@
+#include "qmthemebundle_p.h"
+
+#include <cstring>
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QSaveFile>
+
+#include <QMCore/qmsystem.h>
+
+namespace {
+
+    struct BundleHeader {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+        quint64 indexSize; // The index follows the header
+    };
+
+}
+
+static const char BundleMagic[8] = {'Q', 'M', 'T', 'H', 'E', 'M', 'E', 'B'};
+
+static const quint32 BundleVersion = 1;
+
+static const quint32 BundleByteOrder = 0x01020304;
+
+static const QString BundleSuffix = QStringLiteral("qmtb");
+
+// The opened bundles by the canonical paths and the paths they're opened with, a bundle stays
+// mapped until it's closed and no one holds it. The data returned by entryData() and
+// readThemeFile() doesn't hold the bundle, so it must be copied before the bundle can be closed.
+Q_GLOBAL_STATIC(QMutex, bundlesLock)
+Q_GLOBAL_STATIC(QHash<QString /* fileName */, QSharedPointer<const QMThemeBundle>>, bundles)
+
+static inline QString absoluteCleanPath(const QString &path) {
+    return QDir::cleanPath(QFileInfo(path).absoluteFilePath());
+}
+
+/*!
+    \class QMThemeBundle
+    \internal
+
+    The QMThemeBundle class reads a packed theme bundle, which is an uncompressed archive of a
+    theme directory that is accessed through a memory mapping. The entries of an opened bundle
+    are addressed as if the bundle is a directory, e.g. <tt>/path/theme.qmtb/light.res.json</tt>.
+*/
+
+QMThemeBundle::QMThemeBundle() : size(0), modifyTime(0), data(nullptr) {
+}
+
+QMThemeBundle::~QMThemeBundle() {
+}
+
+/*!
+    \internal
+
+    Returns the content of the entry without copying, which is only valid while the bundle is
+    alive.
+*/
+QByteArray QMThemeBundle::entryData(const QString &name) const {
+    auto it = entries.constFind(name);
+    if (it == entries.constEnd()) {
+        return {};
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(data + it->offset),
+                                   int(it->size));
+}
+
+/*!
+    \internal
+
+    Returns true if the file name has the suffix of the theme bundles.
+*/
+bool QMThemeBundle::isBundleFile(const QString &fileName) {
+    return fileName.endsWith(QLatin1Char('.') + BundleSuffix, Qt::CaseInsensitive);
+}
+
+/*!
+    \internal
+
+    Maps the bundle file and reads its index, returns the bundle that is already opened if any.
+*/
+QSharedPointer<const QMThemeBundle> QMThemeBundle::open(const QString &fileName) {
+    const QFileInfo info(fileName);
+    const QString canonicalPath = info.canonicalFilePath();
+    if (canonicalPath.isEmpty() || !info.isFile()) {
+        return {};
+    }
+
+    // The entries may be addressed through a symbolic link or a relative path
+    const QString absolutePath = absoluteCleanPath(fileName);
+
+    QMutexLocker locker(bundlesLock());
+    auto it = bundles->constFind(canonicalPath);
+    if (it != bundles->constEnd()) {
+        bundles->insert(absolutePath, it.value());
+        return it.value();
+    }
+
+    QSharedPointer<QMThemeBundle> bundle(new QMThemeBundle());
+    bundle->fileName = canonicalPath;
+    bundle->size = info.size();
+    bundle->modifyTime = info.lastModified().toMSecsSinceEpoch();
+
+    auto &file = bundle->file;
+    file.setFileName(canonicalPath);
+    if (!file.open(QIODevice::ReadOnly) || bundle->size < qint64(sizeof(BundleHeader))) {
+        return {};
+    }
+
+    const uchar *data = file.map(0, bundle->size);
+    if (!data) {
+        return {};
+    }
+
+    BundleHeader header;
+    memcpy(&header, data, sizeof(BundleHeader));
+    if (memcmp(header.magic, BundleMagic, sizeof(BundleMagic)) != 0 ||
+        header.version != BundleVersion || header.byteOrder != BundleByteOrder ||
+        header.indexSize > quint64(bundle->size) - sizeof(BundleHeader)) {
+        return {};
+    }
+
+    const QByteArray index = QByteArray::fromRawData(
+        reinterpret_cast<const char *>(data + sizeof(BundleHeader)), int(header.indexSize));
+    QDataStream in(index);
+    in.setVersion(QDataStream::Qt_5_15);
+
+    quint32 count = 0;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString name;
+        Entry entry;
+        in >> name >> entry.offset >> entry.size;
+        if (entry.offset > quint64(bundle->size) ||
+            entry.size > quint64(bundle->size) - entry.offset) {
+            return {};
+        }
+        bundle->entryNames.append(name);
+        bundle->entries.insert(name, entry);
+    }
+    if (in.status() != QDataStream::Ok) {
+        return {};
+    }
+
+    bundle->data = data;
+    bundles->insert(canonicalPath, bundle);
+    bundles->insert(absolutePath, bundle);
+    return bundle;
+}
+
+/*!
+    \internal
+
+    Removes the bundle from the opened ones, the mapping is released when the bundle is no
+    longer referenced.
+*/
+void QMThemeBundle::close(const QString &fileName) {
+    QMutexLocker locker(bundlesLock());
+    auto bundle = bundles->value(absoluteCleanPath(fileName));
+    if (!bundle) {
+        bundle = bundles->value(QFileInfo(fileName).canonicalFilePath());
+    }
+    if (!bundle) {
+        return;
+    }
+    for (auto it = bundles->begin(); it != bundles->end();) {
+        if (it.value() == bundle) {
+            it = bundles->erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
+
+/*!
+    \internal
+
+    Writes the entry to a temporary directory if it's not written yet, and returns the path of
+    the file, so that the resources that Qt loads by the file names can be used.
+*/
+QString QMThemeBundle::extractEntry(const QString &name) const {
+    auto it = entries.constFind(name);
+    if (it == entries.constEnd()) {
+        return {};
+    }
+
+    // A modified bundle is extracted to another directory
+    const auto &hash = QCryptographicHash::hash(
+        (fileName + QLatin1Char(':') + QString::number(modifyTime)).toUtf8(),
+        QCryptographicHash::Sha1);
+    const QString path = QDir::tempPath() + QStringLiteral("/qtmediate-bundles/") +
+                         QString::fromLatin1(hash.toHex()) + QLatin1Char('/') + name;
+
+    const QFileInfo info(path);
+    if (info.isFile() && info.size() == qint64(it->size)) {
+        return path;
+    }
+    if (!QM::mkDir(info.absolutePath())) {
+        return {};
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return {};
+    }
+    file.write(entryData(name));
+    if (!file.commit()) {
+        return {};
+    }
+    return path;
+}
+
+/*!
+    \internal
+
+    Returns the opened bundle that contains the path and sets \a name to the entry name.
+*/
+QSharedPointer<const QMThemeBundle> QMThemeBundle::find(const QString &path, QString *name) {
+    QMutexLocker locker(bundlesLock());
+    if (bundles->isEmpty()) {
+        return {};
+    }
+
+    const QString cleanPath = absoluteCleanPath(path);
+    int i = cleanPath.size();
+    while ((i = cleanPath.lastIndexOf(QLatin1Char('/'), i - 1)) > 0) {
+        auto it = bundles->constFind(cleanPath.left(i));
+        if (it != bundles->constEnd()) {
+            if (name) {
+                *name = cleanPath.mid(i + 1);
+            }
+            return it.value();
+        }
+    }
+    return {};
+}
+
+/*!
+    \internal
+
+    Packs all files of the directory into a bundle.
+*/
+bool QMThemeBundle::pack(const QString &dir, const QString &fileName, QString *errorString) {
+    auto setError = [errorString](const QString &s) {
+        if (errorString) {
+            *errorString = s;
+        }
+        return false;
+    };
+
+    const QDir baseDir(dir);
+    if (!baseDir.exists()) {
+        return setError(QStringLiteral("directory %1 doesn't exist").arg(dir));
+    }
+
+    const QString outputPath = QFileInfo(fileName).absoluteFilePath();
+
+    QStringList names;
+    QList<QByteArray> contents;
+    QDirIterator it(baseDir.absolutePath(), QDir::Files | QDir::NoSymLinks,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString path = it.next();
+        if (path == outputPath) {
+            continue;
+        }
+
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return setError(QStringLiteral("failed to read %1").arg(path));
+        }
+        names.append(baseDir.relativeFilePath(path));
+        contents.append(file.readAll());
+    }
+
+    // The offsets have a fixed size, so the index is written twice to get its size first
+    auto writeIndex = [&](quint64 dataOffset) {
+        QByteArray index;
+        QDataStream out(&index, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_15);
+        out << quint32(names.size());
+        quint64 offset = dataOffset;
+        for (int i = 0; i < names.size(); ++i) {
+            out << names.at(i) << offset << quint64(contents.at(i).size());
+            offset = (offset + contents.at(i).size() + 7) & ~quint64(7);
+        }
+        return index;
+    };
+
+    const quint64 indexSize = writeIndex(0).size();
+    const quint64 dataOffset = (sizeof(BundleHeader) + indexSize + 7) & ~quint64(7);
+    const QByteArray index = writeIndex(dataOffset);
+
+    BundleHeader header;
+    memcpy(header.magic, BundleMagic, sizeof(BundleMagic));
+    header.version = BundleVersion;
+    header.byteOrder = BundleByteOrder;
+    header.indexSize = index.size();
+
+    if (!QM::mkDir(QFileInfo(outputPath).absolutePath())) {
+        return setError(QStringLiteral("failed to create the directory of %1").arg(outputPath));
+    }
+
+    QSaveFile file(outputPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return setError(QStringLiteral("failed to write %1").arg(outputPath));
+    }
+
+    // Every entry starts at an 8-byte boundary
+    auto writePadding = [&file]() {
+        const qint64 padding = (8 - file.pos() % 8) % 8;
+        file.write(QByteArray(int(padding), '\0'));
+    };
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(BundleHeader));
+    file.write(index);
+    writePadding();
+    for (const auto &content : qAsConst(contents)) {
+        file.write(content);
+        writePadding();
+    }
+
+    if (!file.commit()) {
+        return setError(QStringLiteral("failed to write %1").arg(outputPath));
+    }
+    return true;
+}
+
+namespace QMPrivate {
+
+    /*!
+        \internal
+
+        Reads a theme file, the data of the entries in opened bundles is not copied and is only
+        valid while the bundle is open, copy it if it's kept.
+    */
+    bool readThemeFile(const QString &fileName, QByteArray *data) {
+        QString name;
+        if (auto bundle = QMThemeBundle::find(fileName, &name)) {
+            if (!bundle->entries.contains(name)) {
+                return false;
+            }
+            *data = bundle->entryData(name);
+            return true;
+        }
+
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        *data = file.readAll();
+        return true;
+    }
+
+    /*!
+        \internal
+
+        Replaces the \c url() references to the entries of the opened bundles with the extracted
+        files, since Qt reads the images of the style sheets by the file names.
+    */
+    QString resolveBundleUrls(const QString &stylesheet) {
+        if (!stylesheet.contains(QLatin1String("url("))) {
+            return stylesheet;
+        }
+
+        static const QRegularExpression reg(QStringLiteral(R"(url\(\s*(["']?)([^"')]+)\1\s*\))"));
+
+        QString res;
+        int index = 0;
+        auto it = reg.globalMatch(stylesheet);
+        while (it.hasNext()) {
+            const auto &match = it.next();
+
+            QString name;
+            const auto &bundle = QMThemeBundle::find(match.captured(2).trimmed(), &name);
+            if (!bundle) {
+                continue;
+            }
+
+            const QString path = bundle->extractEntry(name);
+            if (path.isEmpty()) {
+                qWarning().noquote() << "failed to extract" << match.captured(2);
+                continue;
+            }
+
+            res += QStringView(stylesheet).mid(index, match.capturedStart(2) - index);
+            res += path;
+            index = match.capturedEnd(2);
+        }
+        res += QStringView(stylesheet).mid(index);
+        return res;
+    }
+
+}
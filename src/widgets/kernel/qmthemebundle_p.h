@@ -0,0 +1,63 @@
+#ifndef QMTHEMEBUNDLE_P_H
+#define QMTHEMEBUNDLE_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QFile>
+#include <QHash>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include <QMWidgets/qmwidgetsglobal.h>
+
+class QM_WIDGETS_EXPORT QMThemeBundle {
+public:
+    ~QMThemeBundle();
+
+    struct Entry {
+        quint64 offset;
+        quint64 size;
+    };
+
+    QString fileName; // Canonical path of the bundle
+    qint64 size;
+    qint64 modifyTime;
+
+    QStringList entryNames; // Relative paths in the order of packing
+    QHash<QString, Entry> entries;
+
+    QByteArray entryData(const QString &name) const;
+    QString extractEntry(const QString &name) const;
+
+    static bool isBundleFile(const QString &fileName);
+    static QSharedPointer<const QMThemeBundle> open(const QString &fileName);
+    static void close(const QString &fileName);
+    static QSharedPointer<const QMThemeBundle> find(const QString &path, QString *name);
+
+    static bool pack(const QString &dir, const QString &fileName, QString *errorString = nullptr);
+
+private:
+    QMThemeBundle();
+
+    QFile file;
+    const uchar *data;
+
+    Q_DISABLE_COPY(QMThemeBundle)
+};
+
+namespace QMPrivate {
+
+    QM_WIDGETS_EXPORT bool readThemeFile(const QString &fileName, QByteArray *data);
+
+    QM_WIDGETS_EXPORT QString resolveBundleUrls(const QString &stylesheet);
+
+}
+
+#endif // QMTHEMEBUNDLE_P_H
@@ -0,0 +1,403 @@
+#include "qmthemecache_p.h"
+
+#include <cstring>
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include <QMCore/qmsystem.h>
+
+#include "qmthemebundle_p.h"
+
+namespace {
+
+    struct CacheHeader {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+        quint64 indexSize;
+        quint64 poolOffset;
+        quint64 poolSize;
+    };
+
+}
+
+static const char CacheMagic[8] = {'Q', 'M', 'T', 'H', 'E', 'M', 'E', 'C'};
+
+// Increase the version when the stylesheet preprocessing changes
+static const quint32 CacheVersion = 4;
+
+static const quint32 CacheByteOrder = 0x01020304;
+
+// Stands for the theme path in the style sheets of the precompiled themes
+static const QLatin1String ThemeDirToken("<qmthemedir>/");
+
+static QDataStream &operator<<(QDataStream &out, const QMThemeFileStamp &stamp) {
+    out << stamp.fileName << stamp.size << stamp.modifyTime << stamp.hash;
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, QMThemeFileStamp &stamp) {
+    in >> stamp.fileName >> stamp.size >> stamp.modifyTime >> stamp.hash;
+    return in;
+}
+
+static QDataStream &operator<<(QDataStream &out, const QMThemePackage::Variable &var) {
+    out << var.themeKey << var.key << var.value << var.priority;
+    return out;
+}
+
+static QDataStream &operator>>(QDataStream &in, QMThemePackage::Variable &var) {
+    in >> var.themeKey >> var.key >> var.value >> var.priority;
+    return in;
+}
+
+/*!
+    \internal
+
+    Reads a compiled theme cache. The stylesheet pool is accessed through a memory mapping of
+    the file without reading it into a buffer, and each style sheet is copied out of the mapping
+    once. The style sheets are not referenced in place, since they outlive the mapping and the
+    cache file is replaced when the themes change.
+*/
+bool QMThemeCache::load(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    const qint64 fileSize = file.size();
+    if (fileSize < qint64(sizeof(CacheHeader))) {
+        return false;
+    }
+
+    // The mapping is released when the file is destroyed
+    const uchar *data = file.map(0, fileSize);
+    if (!data) {
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, data, sizeof(CacheHeader));
+    if (memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+        header.version != CacheVersion || header.byteOrder != CacheByteOrder) {
+        return false;
+    }
+
+    const quint64 indexEnd = sizeof(CacheHeader) + header.indexSize;
+    if (indexEnd > quint64(fileSize) || header.poolOffset < indexEnd ||
+        header.poolOffset % sizeof(QChar) != 0 || header.poolSize % sizeof(QChar) != 0 ||
+        header.poolOffset + header.poolSize > quint64(fileSize)) {
+        return false;
+    }
+
+    QMThemeCache res;
+
+    const QByteArray index = QByteArray::fromRawData(
+        reinterpret_cast<const char *>(data + sizeof(CacheHeader)), int(header.indexSize));
+    QDataStream in(index);
+    in.setVersion(QDataStream::Qt_5_15);
+    in >> res.path >> res.sources;
+
+    const auto pool = reinterpret_cast<const QChar *>(data + header.poolOffset);
+    const quint64 poolLength = header.poolSize / sizeof(QChar);
+
+    quint32 packageCount = 0;
+    in >> packageCount;
+    for (quint32 i = 0; i < packageCount && in.status() == QDataStream::Ok; ++i) {
+        QMThemePackage package;
+        in >> package.fileName >> package.variables >> package.nsMappings;
+
+        quint32 themeCount = 0;
+        in >> themeCount;
+        for (quint32 j = 0; j < themeCount && in.status() == QDataStream::Ok; ++j) {
+            QString themeKey;
+            quint32 nsCount = 0;
+            in >> themeKey >> nsCount;
+
+            QMThemePackage::QssItemMap map;
+            for (quint32 k = 0; k < nsCount && in.status() == QDataStream::Ok; ++k) {
+                QString ns;
+                quint32 priorityCount = 0;
+                in >> ns >> priorityCount;
+
+                auto &nsMap = map[ns];
+                for (quint32 l = 0; l < priorityCount && in.status() == QDataStream::Ok; ++l) {
+                    double priority = 0;
+                    quint32 itemCount = 0;
+                    in >> priority >> itemCount;
+
+                    auto &items = nsMap[priority];
+                    for (quint32 m = 0; m < itemCount && in.status() == QDataStream::Ok; ++m) {
+                        QMThemePackage::QssItem item{1, {}, {}, false, {}, {}, false};
+                        quint64 offset = 0;
+                        quint64 length = 0;
+                        in >> item.ratio >> item.content >> item.fileName >> item.loaded >>
+                            item.stamp >> offset >> length;
+                        if (offset > poolLength || length > poolLength - offset) {
+                            return false;
+                        }
+                        // Copied, the mapping is released when the file is closed
+                        item.result = QString(pool + offset, int(length));
+                        items.append(item);
+                    }
+                }
+            }
+            package.stylesheets.append(qMakePair(themeKey, map));
+        }
+        res.packages.append(package);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    *this = std::move(res);
+    return true;
+}
+
+/*!
+    \internal
+
+    Writes the compiled theme cache atomically.
+*/
+bool QMThemeCache::save(const QString &fileName) const {
+    QByteArray index;
+    QString pool;
+    {
+        QDataStream out(&index, QIODevice::WriteOnly);
+        out.setVersion(QDataStream::Qt_5_15);
+        out << path << sources;
+
+        out << quint32(packages.size());
+        for (const auto &package : packages) {
+            out << package.fileName << package.variables << package.nsMappings;
+
+            out << quint32(package.stylesheets.size());
+            for (const auto &pair : package.stylesheets) {
+                const auto &map = pair.second;
+                out << pair.first << quint32(map.size());
+                for (auto it = map.begin(); it != map.end(); ++it) {
+                    out << it.key() << quint32(it->size());
+                    for (auto it2 = it->begin(); it2 != it->end(); ++it2) {
+                        out << it2.key() << quint32(it2->size());
+                        for (const auto &item : it2.value()) {
+                            out << item.ratio << item.content << item.fileName << item.loaded
+                                << item.stamp << quint64(pool.size())
+                                << quint64(item.result.size());
+                            pool += item.result;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+    header.version = CacheVersion;
+    header.byteOrder = CacheByteOrder;
+    header.indexSize = index.size();
+    header.poolOffset = (sizeof(CacheHeader) + index.size() + 7) & ~quint64(7);
+    header.poolSize = quint64(pool.size()) * sizeof(QChar);
+
+    if (!QM::mkDir(QFileInfo(fileName).absolutePath())) {
+        return false;
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    const QByteArray padding(int(header.poolOffset - sizeof(CacheHeader) - index.size()), '\0');
+    file.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+    file.write(index);
+    file.write(padding);
+    file.write(reinterpret_cast<const char *>(pool.constData()), qint64(header.poolSize));
+    return file.commit();
+}
+
+/*!
+    \internal
+
+    Returns true if the cache is generated from the given path and none of the source files or
+    the stylesheet files whose contents it holds has changed.
+*/
+bool QMThemeCache::isUpToDate(const QString &path, const QFileInfoList &sources) const {
+    if (this->path != path || this->sources.size() != sources.size()) {
+        return false;
+    }
+
+    for (int i = 0; i < sources.size(); ++i) {
+        const auto &stamp = this->sources.at(i);
+        if (stamp.fileName != sources.at(i).absoluteFilePath() || !stamp.isUpToDate()) {
+            return false;
+        }
+    }
+
+    for (const auto &package : packages) {
+        for (const auto &pair : package.stylesheets) {
+            for (const auto &priorityMap : pair.second) {
+                for (const auto &items : priorityMap) {
+                    for (const auto &item : items) {
+                        if (item.loaded && !item.fileName.isEmpty() && !item.stamp.isUpToDate()) {
+                            return false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns the cache file location of the given theme path.
+*/
+QString QMThemeCache::cacheFileName(const QString &dir, const QString &path) {
+    const auto &hash = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1);
+    return QDir(dir).filePath(QString::fromLatin1(hash.toHex()) + QStringLiteral(".qmtc"));
+}
+
+/*!
+    \internal
+
+    Returns the location of the precompiled themes of the given theme path.
+*/
+QString QMThemeCache::compiledFileName(const QString &path) {
+    return QDir(path).filePath(QStringLiteral("themes.qmtc"));
+}
+
+/*!
+    \internal
+
+    Loads the precompiled themes shipped in the theme path, returns false if there's none or the
+    theme files have been changed since they're compiled. If the theme files are not shipped,
+    the precompiled themes are used as they are.
+*/
+bool QMThemeCache::loadCompiled(const QString &path, const QFileInfoList &sources) {
+    QMThemeCache res;
+    if (!res.load(compiledFileName(path))) {
+        return false;
+    }
+    res.relocate(path);
+
+    if (!sources.isEmpty()) {
+        if (!res.isUpToDate(path, sources)) {
+            return false;
+        }
+    } else {
+        for (auto &package : res.packages) {
+            for (const auto &item : package.items()) {
+                item->pinned = true;
+            }
+        }
+    }
+
+    *this = std::move(res);
+    return true;
+}
+
+/*!
+    \internal
+
+    Resolves the file names and the paths in the style sheets of the precompiled themes, which
+    are relative to the theme path, against the given path.
+*/
+void QMThemeCache::relocate(const QString &path) {
+    const QString to = QDir(path).absolutePath() + QLatin1Char('/');
+    this->path = path;
+
+    auto rebase = [&](QString &fileName) {
+        if (!fileName.isEmpty() && QDir::isRelativePath(fileName)) {
+            fileName.prepend(to);
+        }
+    };
+
+    for (auto &stamp : sources) {
+        rebase(stamp.fileName);
+    }
+    for (auto &package : packages) {
+        rebase(package.fileName);
+        for (const auto &item : package.items()) {
+            rebase(item->fileName);
+            rebase(item->stamp.fileName);
+            item->result.replace(ThemeDirToken, to);
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Parses the theme files in the path and evaluates all style sheets, then writes the result in
+    the format of the cache. The file can be loaded by loadCompiled() from the theme path at
+    runtime, even if the themes are moved to another location or their modify times change.
+*/
+bool QMThemeCache::compile(const QString &path, const QString &fileName, QString *errorString) {
+    auto setError = [errorString](const QString &s) {
+        if (errorString) {
+            *errorString = s;
+        }
+        return false;
+    };
+
+    // The output only holds the paths relative to the theme path and the hashes of the files, so
+    // that it's the same wherever and whenever the themes are compiled
+    const QString from = QDir(path).absolutePath() + QLatin1Char('/');
+    auto rebase = [&](QString &fileName) {
+        if (fileName.startsWith(from)) {
+            fileName.remove(0, from.size());
+        }
+    };
+
+    QMThemeCache cache;
+
+    const QFileInfoList files = QMThemePackage::searchFiles(path);
+    for (const auto &file : files) {
+        QMThemePackage package;
+        if (!package.load(file.absoluteFilePath())) {
+            return setError(QStringLiteral("invalid theme package %1").arg(file.filePath()));
+        }
+        rebase(package.fileName);
+
+        for (const auto &item : package.items()) {
+            item->readStyleSheet();
+            if (item->fileName.isEmpty()) {
+                continue;
+            }
+            if (!item->loaded) {
+                return setError(QStringLiteral("failed to read %1").arg(item->fileName));
+            }
+
+            // The images of the bundles are extracted to the temporary directory of this
+            // machine, such style sheets are read at runtime
+            if (QMThemeBundle::find(item->fileName, nullptr)) {
+                item->loaded = false;
+                item->result.clear();
+            } else {
+                item->result.replace(from, ThemeDirToken);
+            }
+
+            item->stamp = QMThemeFileStamp::fromContents(item->fileName);
+            rebase(item->stamp.fileName);
+            rebase(item->fileName);
+        }
+
+        auto stamp = QMThemeFileStamp::fromContents(file.absoluteFilePath());
+        rebase(stamp.fileName);
+        cache.sources.append(stamp);
+        cache.packages.append(package);
+    }
+
+    if (!cache.save(fileName)) {
+        return setError(QStringLiteral("failed to write %1").arg(fileName));
+    }
+    return true;
+}
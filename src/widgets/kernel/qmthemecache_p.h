@@ -0,0 +1,40 @@
+#ifndef QMTHEMECACHE_P_H
+#define QMTHEMECACHE_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QVector>
+
+#include <QMWidgets/qmwidgetsglobal.h>
+
+#include "qmthemepackage_p.h"
+
+class QM_WIDGETS_EXPORT QMThemeCache {
+public:
+    QString path;
+    QList<QMThemeFileStamp> sources; // *.res.json files
+    QVector<QMThemePackage> packages;
+
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+
+    bool isUpToDate(const QString &path, const QFileInfoList &sources) const;
+
+    bool loadCompiled(const QString &path, const QFileInfoList &sources);
+    void relocate(const QString &path);
+
+    static QString cacheFileName(const QString &dir, const QString &path);
+    static QString compiledFileName(const QString &path);
+
+    static bool compile(const QString &path, const QString &fileName,
+                        QString *errorString = nullptr);
+};
+
+#endif // QMTHEMECACHE_P_H
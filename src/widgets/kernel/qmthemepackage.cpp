@@ -0,0 +1,391 @@
+#include "qmthemepackage_p.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+
+#include "qmdecoratorv2.h"
+#include "qmthemebundle_p.h"
+
+QMThemeFileStamp QMThemeFileStamp::fromFileInfo(const QFileInfo &info) {
+    // The entries of a bundle share the modify time of the bundle
+    QString name;
+    if (auto bundle = QMThemeBundle::find(info.absoluteFilePath(), &name)) {
+        auto it = bundle->entries.constFind(name);
+        if (it == bundle->entries.constEnd()) {
+            return {info.absoluteFilePath(), -1, -1, {}};
+        }
+        return {info.absoluteFilePath(), qint64(it->size), bundle->modifyTime, {}};
+    }
+
+    if (!info.exists()) {
+        return {info.absoluteFilePath(), -1, -1, {}};
+    }
+    return {info.absoluteFilePath(), info.size(), info.lastModified().toMSecsSinceEpoch(), {}};
+}
+
+QMThemeFileStamp QMThemeFileStamp::fromFileName(const QString &fileName) {
+    return fromFileInfo(QFileInfo(fileName));
+}
+
+// The stamps of the precompiled themes, which don't depend on where and when the files are
+// copied to
+QMThemeFileStamp QMThemeFileStamp::fromContents(const QString &fileName) {
+    QByteArray data;
+    if (!QMPrivate::readThemeFile(fileName, &data)) {
+        return {fileName, -1, -1, {}};
+    }
+    return {fileName, data.size(), -1, QCryptographicHash::hash(data, QCryptographicHash::Sha1)};
+}
+
+bool QMThemeFileStamp::isUpToDate() const {
+    if (hash.isEmpty()) {
+        return *this == fromFileName(fileName);
+    }
+
+    // Compare the sizes first to avoid reading the files that are obviously changed
+    if (fromFileName(fileName).size != size) {
+        return false;
+    }
+    return *this == fromContents(fileName);
+}
+
+static const QStringList &platformKeys() {
+    static QStringList keys{
+#ifdef Q_OS_WINDOWS
+        QStringLiteral("win"),
+        QStringLiteral("win32"),
+        QStringLiteral("windows"),
+#elif defined(Q_OS_LINUX)
+        QStringLiteral("linux"),
+#else
+        QStringLiteral("mac"),
+        QStringLiteral("macos"),
+        QStringLiteral("osx"),
+        QStringLiteral("macosx"),
+#endif
+    };
+    return keys;
+}
+
+template <class T>
+static T parsePlatform(const QJsonValue &val, bool(predicate)(const QJsonValue &),
+                       T(convert)(const QJsonValue &), const T &defaultValue = T{}) {
+    if (predicate(val)) {
+        return convert(val);
+    }
+
+    auto obj = val.toObject();
+    for (auto it = obj.begin(); it != obj.end(); ++it) {
+        if (platformKeys().contains(it.key(), Qt::CaseInsensitive)) {
+            if (predicate(it.value())) {
+                return convert(it.value());
+            }
+            return defaultValue;
+        }
+    }
+    return defaultValue;
+};
+
+static double parsePlatformDouble(const QJsonValue &val, double defaultValue = 0) {
+    return parsePlatform<double>(
+        val, [](const QJsonValue &val) { return val.isDouble(); },
+        [](const QJsonValue &val) { return val.toDouble(); }, defaultValue);
+}
+
+static QString parsePlatformString(const QJsonValue &val, const QString &defaultValue = {}) {
+    return parsePlatform<QString>(
+        val, [](const QJsonValue &val) { return val.isString(); },
+        [](const QJsonValue &val) { return val.toString(); }, defaultValue);
+}
+
+/*!
+    \internal
+
+    Reads the stylesheet content of the item and expands the extension syntax, this function
+    is safe to be called from a worker thread.
+*/
+void QMThemePackage::QssItem::readStyleSheet() {
+    QString text;
+    if (!fileName.isEmpty()) {
+        stamp = QMThemeFileStamp::fromFileName(fileName);
+
+        QByteArray data;
+        if (!QMPrivate::readThemeFile(fileName, &data)) {
+            return;
+        }
+        text = QString::fromUtf8(data);
+
+        // Replace relative paths
+        QFileInfo info(fileName);
+        text.replace(QRegularExpression(QStringLiteral(R"(@[/\\])")),
+                     info.absolutePath() + QStringLiteral("/"));
+
+        // Qt can't read the images inside the bundles
+        if (QMThemeBundle::find(fileName, nullptr)) {
+            text = QMPrivate::resolveBundleUrls(text);
+        }
+    } else {
+        text = content;
+    }
+
+    if (text.isEmpty()) {
+        return;
+    }
+
+    result = QMDecoratorV2::evaluateStyleSheet(text, ratio);
+    loaded = true;
+}
+
+/*!
+    \internal
+
+    Parses a \c *.res.json file, returns false if the file is not a valid theme package.
+*/
+bool QMThemePackage::load(const QString &fileName) {
+    QByteArray data;
+    if (!QMPrivate::readThemeFile(fileName, &data)) {
+        return false;
+    }
+
+    QJsonParseError err;
+    QJsonDocument doc = QJsonDocument::fromJson(data, &err);
+    if (err.error != QJsonParseError::NoError || !doc.isObject()) {
+        return false;
+    }
+
+    this->fileName = fileName;
+
+    const QString dirPath = QFileInfo(fileName).absolutePath();
+
+    double ratio = 1;
+    double priority = 1;
+
+    auto objDoc = doc.object();
+
+    QJsonValue value;
+
+    // Get default values
+    value = objDoc.value(QStringLiteral("config"));
+    if (!value.isUndefined() && value.isObject()) {
+        auto obj = value.toObject();
+        value = obj.value(QStringLiteral("ratio"));
+        if (!value.isUndefined()) {
+            auto _tmp = parsePlatformDouble(value);
+            if (_tmp > 0)
+                ratio = _tmp;
+        }
+
+        value = obj.value(QStringLiteral("priority"));
+        if (!value.isUndefined()) {
+            auto _tmp = parsePlatformDouble(value, -1);
+            if (_tmp >= 0)
+                priority = _tmp;
+        }
+    }
+
+    value = objDoc.value(QStringLiteral("variables"));
+    if (!value.isUndefined() && value.isObject()) {
+        auto obj = value.toObject();
+        for (auto it0 = obj.begin(); it0 != obj.end(); ++it0) {
+            if (!it0->isObject()) {
+                continue;
+            }
+            auto themeObj = it0->toObject();
+            if (themeObj.isEmpty()) {
+                continue;
+            }
+
+            const auto &themeKey = it0.key();
+            for (auto it = themeObj.begin(); it != themeObj.end(); ++it) {
+                const auto &key = it.key();
+                QString val;
+                double _priority = priority;
+
+                if (it->isObject()) {
+                    auto varObj = it->toObject();
+                    value = varObj.value(QStringLiteral("priority"));
+                    if (value.isDouble()) {
+                        priority = value.toDouble();
+                    }
+                    value = varObj.value(QStringLiteral("value"));
+                    if (value.isString()) {
+                        val = value.toString();
+                    }
+                } else if (it->isString()) {
+                    val = it->toString();
+                }
+
+                variables.append(Variable{themeKey, key, val, _priority});
+            }
+        }
+    }
+
+    auto parseStyleObject = [&](QssItemMap &map, const QString &key, const QJsonObject &obj) {
+        QssItem item{ratio, {}, {}, false, {}, {}, false};
+        QJsonValue value;
+
+        value = obj.value(QStringLiteral("file"));
+        if (!value.isUndefined()) {
+            QString qssFile = parsePlatformString(value);
+            if (!qssFile.isEmpty()) {
+                if (QDir::isRelativePath(qssFile)) {
+                    qssFile = dirPath + QStringLiteral("/") + qssFile;
+                }
+                item.fileName = qssFile;
+                goto out;
+            }
+        }
+
+        value = obj.value(QStringLiteral("content"));
+        if (!value.isUndefined()) {
+            QString content = parsePlatformString(value);
+            if (!content.isEmpty()) {
+                item.content = content;
+                goto out;
+            }
+        }
+
+        return;
+
+    out:
+        value = obj.value(QStringLiteral("ratio"));
+        if (!value.isUndefined()) {
+            auto _tmp = parsePlatformDouble(value);
+            if (_tmp > 0)
+                item.ratio = _tmp;
+        }
+
+        auto _priority = priority;
+
+        value = obj.value(QStringLiteral("priority"));
+        if (!value.isUndefined()) {
+            auto _tmp = parsePlatformDouble(value, -1);
+            if (_tmp >= 0)
+                _priority = _tmp;
+        }
+
+        map[key][_priority].append(item);
+    };
+
+    // Get namespaces
+    value = objDoc.value(QStringLiteral("widgets"));
+    if (!value.isUndefined() && value.isObject()) {
+        auto obj = value.toObject();
+        for (auto it = obj.begin(); it != obj.end(); ++it) {
+            QStringList keys;
+            if (it->isArray()) {
+                for (const auto &item : it->toArray()) {
+                    if (item.isString())
+                        keys.append(item.toString());
+                }
+            } else if (it->isString()) {
+                keys.append(it->toString());
+            }
+            nsMappings.append(qMakePair(it.key(), keys));
+        }
+    }
+
+    value = objDoc.value(QStringLiteral("stylesheets"));
+    if (!value.isUndefined() && value.isObject()) {
+        auto obj = value.toObject();
+        for (auto it = obj.begin(); it != obj.end(); ++it) {
+            if (!it->isObject()) {
+                continue;
+            }
+
+            const QString &themeKey = it.key();
+            auto themeObj = it->toObject();
+
+            QssItemMap map;
+            for (auto it1 = themeObj.begin(); it1 != themeObj.end(); ++it1) {
+                if (it1->isArray()) {
+                    for (const auto &item : it1->toArray()) {
+                        if (item.isObject()) {
+                            parseStyleObject(map, it1.key(), item.toObject());
+                        }
+                    }
+                } else if (it1->isObject()) {
+                    parseStyleObject(map, it1.key(), it1->toObject());
+                }
+            }
+
+            if (map.isEmpty()) {
+                continue;
+            }
+            stylesheets.append(qMakePair(themeKey, map));
+        }
+    }
+
+    return true;
+}
+
+/*!
+    \internal
+
+    Returns all the stylesheet items of the package.
+*/
+QList<QMThemePackage::QssItem *> QMThemePackage::items() {
+    QList<QssItem *> res;
+    for (auto &pair : stylesheets) {
+        for (auto it = pair.second.begin(); it != pair.second.end(); ++it) {
+            for (auto it2 = it->begin(); it2 != it->end(); ++it2) {
+                for (auto &item : it2.value()) {
+                    res.append(&item);
+                }
+            }
+        }
+    }
+    return res;
+}
+
+static bool isPackageFile(const QString &fileName) {
+    return fileName.endsWith(QStringLiteral(".res.json"), Qt::CaseInsensitive);
+}
+
+static void searchBundle(const QString &fileName, QFileInfoList *res) {
+    auto bundle = QMThemeBundle::open(fileName);
+    if (!bundle) {
+        return;
+    }
+    for (const auto &name : bundle->entryNames) {
+        if (isPackageFile(name)) {
+            res->append(QFileInfo(bundle->fileName + QLatin1Char('/') + name));
+        }
+    }
+}
+
+/*!
+    \internal
+
+    Returns all the \c *.res.json files in the directory recursively, the packages in the theme
+    bundles are returned with the paths inside the bundles. The path can also be a bundle file.
+*/
+QFileInfoList QMThemePackage::searchFiles(const QString &path) {
+    QFileInfoList res;
+    if (QMThemeBundle::isBundleFile(path) && QFileInfo(path).isFile()) {
+        searchBundle(path, &res);
+        return res;
+    }
+
+    QStringList searchPaths = {path};
+    while (!searchPaths.isEmpty()) {
+        const QDir dir(searchPaths.takeFirst());
+        const QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::NoSymLinks);
+        foreach (const QFileInfo &file, files) {
+            if (!file.completeSuffix().compare(QStringLiteral("res.json"), Qt::CaseInsensitive)) {
+                res.append(file);
+            } else if (QMThemeBundle::isBundleFile(file.fileName())) {
+                searchBundle(file.absoluteFilePath(), &res);
+            }
+        }
+        const QFileInfoList dirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot);
+        foreach (const QFileInfo &subdir, dirs)
+            searchPaths << subdir.absoluteFilePath();
+    }
+    return res;
+}
@@ -0,0 +1,88 @@
+#ifndef QMTHEMEPACKAGE_P_H
+#define QMTHEMEPACKAGE_P_H
+
+//
+//  W A R N I N G !!!
+//  -----------------
+//
+// This file is not part of the QtMediate API. It is used purely as an
+// implementation detail. This header file may change from version to
+// version without notice, or may even be removed.
+//
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+
+#include <QMWidgets/qmwidgetsglobal.h>
+
+struct QMThemeFileStamp {
+    QString fileName;
+    qint64 size;
+    qint64 modifyTime; // -1 if the stamp holds the content hash
+    QByteArray hash;
+
+    inline bool operator==(const QMThemeFileStamp &other) const {
+        return fileName == other.fileName && size == other.size &&
+               modifyTime == other.modifyTime && hash == other.hash;
+    }
+    inline bool operator!=(const QMThemeFileStamp &other) const {
+        return !(*this == other);
+    }
+
+    bool isUpToDate() const;
+
+    static QMThemeFileStamp fromFileInfo(const QFileInfo &info);
+    static QMThemeFileStamp fromFileName(const QString &fileName);
+    static QMThemeFileStamp fromContents(const QString &fileName);
+};
+
+class QMThemePackage {
+public:
+    struct QssItem {
+        double ratio;
+        QString content;
+        QString fileName;
+
+        // Filled in by readStyleSheet()
+        bool loaded;
+        QString result;
+        QMThemeFileStamp stamp;
+
+        // The result can't be read again, e.g. precompiled without shipping the files
+        bool pinned;
+
+        void readStyleSheet();
+
+        friend QDebug operator<<(QDebug debug, const QssItem &item) {
+            debug << "QssItem(" << item.ratio << ", "
+                  << (item.fileName.isEmpty() ? item.content : item.fileName) << ")";
+            return debug;
+        }
+    };
+
+    // namespace - [ priority - items ]
+    using QssItemMap = QMap<QString, QMap<double, QList<QssItem>>>;
+
+    struct Variable {
+        QString themeKey;
+        QString key;
+        QString value;
+        double priority;
+    };
+
+    QString fileName;
+    QList<Variable> variables;
+    QList<QPair<QString, QStringList>> nsMappings; // widgetKey - namespaces
+    QList<QPair<QString, QssItemMap>> stylesheets; // themeKey - items
+
+    bool load(const QString &fileName);
+
+    QList<QssItem *> items();
+
+    static QFileInfoList searchFiles(const QString &path);
+};
+
+#endif // QMTHEMEPACKAGE_P_H
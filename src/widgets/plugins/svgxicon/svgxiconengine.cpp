@@ -13,22 +13,32 @@
 
 #include "qmsvgx_p.h"
 #include "qmappextension_p.h"
+#include "qmthemebundle_p.h"
 
 QAtomicInt SvgxIconEnginePrivate::lastSerialNum;
 
 QString SvgxIconEnginePrivate::pmcKey(const QSize &size, QIcon::Mode mode, QIcon::State state) {
-    Q_UNUSED(mode)
     Q_UNUSED(state)
 
     syncData();
 
-    // Cache key arguments: serial num, size, current state, color
+    // The pixmap only depends on the file and the color, so the engines created for the same
+    // icon by different style sheets share the cache entries, and the entries of the icons that
+    // a theme switch doesn't change stay valid. The global serial num is increased when the
+    // theme files are reloaded or the svg files in the theme paths change.
+    const auto &fileName = svgScripts[currentState].fileName;
+
+    // Cache key arguments: global serial num, file or serial num, size, current state, mode,
+    // color
     return QLatin1String("$qm_svgxicon_") +
            QString::number(QMAppExtensionPrivate::globalIconCacheSerialNum, 16)
                .append(QLatin1Char('_')) +
-           QString::number(serialNum, 16).append(QLatin1Char('_')) +
-           QString::number((((qint64(size.width()) << 11) | size.height()) << 11) | currentState,
-                           16)
+           (fileName.isEmpty() ? QString::number(serialNum, 16) : fileName)
+               .append(QLatin1Char('_')) +
+           QString::number(
+               (((((qint64(size.width()) << 11) | size.height()) << 11) | currentState) << 4) |
+                   mode,
+               16)
                .append(QLatin1Char('_')) +
            colorHint;
 }
@@ -74,13 +84,17 @@ void SvgxIconEnginePrivate::syncData() {
     if (item.fileName.isEmpty())
         return;
 
-    // Read file (Lazy)
-    if (item.data.isEmpty()) {
-        QFile file(item.fileName);
-        if (file.open(QIODevice::ReadOnly)) {
-            item.data = file.readAll();
+    // Read file (Lazy), the data of a bundle is copied since the bundle may be closed. The file
+    // is read again after the global serial num changes, which happens when the theme files or
+    // the svg files in the theme paths are changed.
+    const int globalSerialNum = QMAppExtensionPrivate::globalIconCacheSerialNum;
+    if (item.data.isEmpty() || item.dataSerialNum != globalSerialNum) {
+        QByteArray data;
+        if (QMPrivate::readThemeFile(item.fileName, &data)) {
+            item.data = QByteArray(data.constData(), data.size());
             item.hasCurrentColor = item.data.contains("currentColor");
         }
+        item.dataSerialNum = globalSerialNum;
     }
 
     // Update color
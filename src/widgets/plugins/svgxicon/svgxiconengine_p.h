@@ -36,8 +36,10 @@ public:
         QString fileName;
         QByteArray data;
         bool hasCurrentColor;
+        int dataSerialNum; // The global serial num when the data is read
 
-        SvgScript(const QString &fileName = {}) : fileName(fileName), hasCurrentColor(false) {
+        SvgScript(const QString &fileName = {})
+            : fileName(fileName), hasCurrentColor(false), dataSerialNum(-1) {
         }
     };
     QMButtonAttributes<SvgScript> svgScripts;
@@ -0,0 +1,343 @@
+#include <QDir>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QStringView>
+#include <QtTest>
+
+#include <QMCore/qmsimplevarexp.h>
+#include <QMWidgets/qmdecoratorv2.h>
+#include <QMWidgets/private/qmstylesheetrewriter_p.h>
+
+// The regular expression chain that QMDecoratorV2::evaluateStyleSheet used to run, the
+// rewriter must produce exactly the same output.
+namespace Reference {
+
+    static QString replaceFontSizes(const QString &stylesheet, double ratio, bool rounding) {
+        static QRegularExpression re(
+            QStringLiteral(R"(font-size\s*:\s*([0-9]+(\.[0-9]+|)px)\s*;)"));
+        QRegularExpressionMatch match;
+        int index = 0;
+        int lastIndex = 0;
+        QString result;
+        while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
+            result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
+
+            auto matchString = match.capturedView(1);
+            double size = matchString.mid(0, matchString.size() - 2).toDouble();
+            size *= ratio;
+            result += QStringLiteral("font-size: ") +
+                      (rounding ? QString::number(int(size)) : QString::number(size)) +
+                      QStringLiteral("px;");
+            index += match.captured().size();
+            lastIndex = index;
+        }
+        result += QStringView(stylesheet).mid(lastIndex);
+        return result;
+    }
+
+    static QString replaceSizes(const QString &stylesheet, double ratio, bool rounding) {
+        static QRegularExpression re(QStringLiteral(R"([0-9]+(\.[0-9]+|)px)"));
+        QRegularExpressionMatch match;
+        int index = 0;
+        int lastIndex = 0;
+        QString result;
+        while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
+            result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
+
+            auto matchString = match.capturedView();
+            double size = matchString.mid(0, matchString.size() - 2).toDouble();
+            size *= ratio;
+            result += (rounding ? QString::number(int(size)) : QString::number(size)) +
+                      QStringLiteral("px");
+            index += matchString.size();
+            lastIndex = index;
+        }
+        result += QStringView(stylesheet).mid(lastIndex);
+        return result;
+    }
+
+    static QString replaceCustomKeyWithQProperty(const QString &stylesheet) {
+        static QRegularExpression re(QStringLiteral(R"((\{|;|^)\s*(--|---)\w(\w|-)*:)"),
+                                     QRegularExpression::MultilineOption |
+                                         QRegularExpression::DotMatchesEverythingOption);
+        QRegularExpressionMatch match;
+        int index = 0;
+        int lastIndex = 0;
+        QString result;
+        while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
+            result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
+
+            auto matchString = match.capturedView();
+            auto capturedIndex = match.capturedStart(2) - index;
+            auto capturedLen = match.capturedLength(2);
+            auto valueString = matchString.toString();
+            valueString.replace(capturedIndex, capturedLen,
+                                capturedLen == 2 ? QStringLiteral("qproperty-") : QString());
+
+            result += valueString;
+            index += matchString.size();
+            lastIndex = index;
+        }
+        result += QStringView(stylesheet).mid(lastIndex);
+        return result;
+    }
+
+    static QString replaceCssGrammars(const QString &stylesheet) {
+        QString result;
+        {
+            static QRegularExpression re(QStringLiteral(R"(:not\(\s*:([^)]+)\s*\))"),
+                                         QRegularExpression::MultilineOption |
+                                             QRegularExpression::DotMatchesEverythingOption);
+            QRegularExpressionMatch match;
+            int index = 0;
+            int lastIndex = 0;
+            while ((index = stylesheet.indexOf(re, index, &match)) != -1) {
+                result += QStringView(stylesheet).mid(lastIndex, index - lastIndex);
+                result += QStringLiteral(":!") + match.captured(1).trimmed();
+                index += match.captured().size();
+                lastIndex = index;
+            }
+            result += QStringView(stylesheet).mid(lastIndex);
+        }
+        {
+            static QRegularExpression re(QStringLiteral(R"(svg\((.*?)\)(;|\s*\}))"),
+                                         QRegularExpression::MultilineOption |
+                                             QRegularExpression::DotMatchesEverythingOption);
+            result.replace(re, QStringLiteral(R"(url("[[\1]].svgx")\2)"));
+        }
+        return result;
+    }
+
+    static QString removeAllComments(const QString &stylesheet) {
+        static QRegularExpression re(QStringLiteral(R"(\/\*(.*?)\*\/)"),
+                                     QRegularExpression::MultilineOption |
+                                         QRegularExpression::DotMatchesEverythingOption);
+        QString result = stylesheet;
+        return result.remove(re);
+    }
+
+    static QString evaluateStyleSheet(const QString &stylesheet, double ratio, double fontRatio) {
+        QString content = removeAllComments(stylesheet);
+        content = replaceCustomKeyWithQProperty(content);
+        content = replaceCssGrammars(content);
+        if (fontRatio != 1 && fontRatio > 0) {
+            content = replaceFontSizes(content, fontRatio, false);
+        }
+        if (ratio != 1 && ratio > 0) {
+            content = replaceSizes(content, ratio, false);
+        }
+        return content;
+    }
+
+    static QString scaleSizes(const QString &stylesheet, double ratio, double fontRatio) {
+        QString content = stylesheet;
+        if (fontRatio != 1 && fontRatio > 0) {
+            content = replaceFontSizes(content, fontRatio, false);
+        }
+        if (ratio != 1 && ratio > 0) {
+            content = replaceSizes(content, ratio, true);
+        }
+        return content;
+    }
+
+}
+
+class tst_StyleSheet : public QObject {
+    Q_OBJECT
+private:
+    static void addRows(const QString &name, const QString &content);
+
+private Q_SLOTS:
+    void evaluate_data();
+    void evaluate();
+    void scaleSizes_data();
+    void scaleSizes();
+    void formatTemplate_data();
+    void formatTemplate();
+    void scaledSizes_data();
+    void scaledSizes();
+    void bindTemplate_data();
+    void bindTemplate();
+    void bindCycles();
+};
+
+// ratio - fontRatio
+static const double ratios[][2] = {
+    {1, 1}, {1.5, 1}, {1, 1.25}, {1.25, 0.8}, {2, 2}, {0, -1},
+};
+
+// Random sheets made of the fragments the rewriter reacts to
+static QStringList randomSheets() {
+    static const char *const tokens[] = {
+        "/*", "*/", "{", "}", ";", ":", "\n", " ", "\t", "\r\n", "\v", "-", "--", "---", "--k:",
+        "a", "b_1", "x-y", "qproperty", ":not(", ":not( :", "(", ")", "svg(", "font-size",
+        "font-size:", "font-size : 10px ;", "12px", "3.5px", ".5px", "7.px", "1e5px", "0", "9",
+        "px", "p", ".", " svg(\":/x.svg\", \"#fff\");",
+    };
+    const int count = sizeof(tokens) / sizeof(tokens[0]);
+
+    QRandomGenerator rng(20231017);
+    QStringList res;
+    for (int i = 0; i < 2000; ++i) {
+        QString s;
+        const int len = rng.bounded(40);
+        for (int j = 0; j < len; ++j) {
+            s += QString::fromUtf8(tokens[rng.bounded(count)]);
+        }
+        res.append(s);
+    }
+    return res;
+}
+
+void tst_StyleSheet::addRows(const QString &name, const QString &content) {
+    for (const auto &ratio : ratios) {
+        const QString row = QStringLiteral("%1 (%2, %3)").arg(name).arg(ratio[0]).arg(ratio[1]);
+        QTest::newRow(row.toUtf8().constData()) << content << ratio[0] << ratio[1];
+    }
+}
+
+void tst_StyleSheet::evaluate_data() {
+    QTest::addColumn<QString>("stylesheet");
+    QTest::addColumn<double>("ratio");
+    QTest::addColumn<double>("fontRatio");
+
+    const QDir dir(QStringLiteral(TST_CORPUS_DIR));
+    const auto &files = dir.entryInfoList({QStringLiteral("*.qss")}, QDir::Files, QDir::Name);
+    QVERIFY(!files.isEmpty());
+    for (const auto &info : files) {
+        QFile file(info.absoluteFilePath());
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        addRows(info.fileName(), QString::fromUtf8(file.readAll()));
+    }
+
+    const auto &sheets = randomSheets();
+    for (int i = 0; i < sheets.size(); ++i) {
+        addRows(QStringLiteral("random-%1").arg(i), sheets.at(i));
+    }
+}
+
+void tst_StyleSheet::evaluate() {
+    QFETCH(QString, stylesheet);
+    QFETCH(double, ratio);
+    QFETCH(double, fontRatio);
+
+    QCOMPARE(QMDecoratorV2::evaluateStyleSheet(stylesheet, ratio, fontRatio),
+             Reference::evaluateStyleSheet(stylesheet, ratio, fontRatio));
+}
+
+void tst_StyleSheet::scaleSizes_data() {
+    evaluate_data();
+}
+
+void tst_StyleSheet::scaleSizes() {
+    QFETCH(QString, stylesheet);
+    QFETCH(double, ratio);
+    QFETCH(double, fontRatio);
+
+    QCOMPARE(QMPrivate::scaleStyleSheetSizes(stylesheet, ratio, fontRatio, true),
+             Reference::scaleSizes(stylesheet, ratio, fontRatio));
+}
+
+void tst_StyleSheet::formatTemplate_data() {
+    evaluate_data();
+}
+
+void tst_StyleSheet::formatTemplate() {
+    QFETCH(QString, stylesheet);
+    QFETCH(double, ratio);
+    QFETCH(double, fontRatio);
+
+    const auto &tpl = QMStyleSheetTemplate::fromSizes(stylesheet);
+    QCOMPARE(tpl.format(ratio, fontRatio, true),
+             Reference::scaleSizes(stylesheet, ratio, fontRatio));
+    QCOMPARE(tpl.format(ratio, fontRatio, false),
+             QMPrivate::scaleStyleSheetSizes(stylesheet, ratio, fontRatio, false));
+}
+
+void tst_StyleSheet::scaledSizes_data() {
+    evaluate_data();
+}
+
+void tst_StyleSheet::scaledSizes() {
+    QFETCH(QString, stylesheet);
+    QFETCH(double, ratio);
+    QFETCH(double, fontRatio);
+
+    // The formatted text is reused for the nearby ratios whose sizes are the same
+    const auto &tpl = QMStyleSheetTemplate::fromSizes(stylesheet);
+    const auto &sizes = tpl.scaledSizes(ratio, fontRatio, true);
+    const auto &text = tpl.format(ratio, fontRatio, true);
+    for (double delta : {0.001, 0.01, 0.05}) {
+        if (tpl.scaledSizes(ratio + delta, fontRatio, true) == sizes) {
+            QCOMPARE(tpl.format(ratio + delta, fontRatio, true), text);
+        }
+        if (tpl.scaledSizes(ratio, fontRatio + delta, true) == sizes) {
+            QCOMPARE(tpl.format(ratio, fontRatio + delta, true), text);
+        }
+    }
+}
+
+void tst_StyleSheet::bindTemplate_data() {
+    QTest::addColumn<QString>("stylesheet");
+
+    // The references are well-formed, a single "$" could form references with the values
+    // around it, which QMSimpleVarExp resolves in a different order
+    static const char *const tokens[] = {
+        "$$", "{", "}", "a", "b", "${a}", "${b}", "$${a}", "$$${c}", "${d}", "${e}", "${}",
+        "\n", "px", "1", "${unknown}",
+    };
+    const int count = sizeof(tokens) / sizeof(tokens[0]);
+
+    QRandomGenerator rng(20231018);
+    for (int i = 0; i < 2000; ++i) {
+        QString s;
+        const int len = rng.bounded(16);
+        for (int j = 0; j < len; ++j) {
+            s += QString::fromUtf8(tokens[rng.bounded(count)]);
+        }
+        QTest::newRow(QByteArray::number(i).constData()) << s;
+    }
+}
+
+void tst_StyleSheet::bindTemplate() {
+    QFETCH(QString, stylesheet);
+
+    // Nested references and escapes, no cycles
+    const QHash<QString, QString> variables{
+        {QStringLiteral("a"), QStringLiteral("1")},
+        {QStringLiteral("b"), QStringLiteral("${a}px")},
+        {QStringLiteral("c"), QStringLiteral("x$$y")},
+        {QStringLiteral("d"), QStringLiteral("{a}")},
+        {QStringLiteral("e"), QStringLiteral("${b} ${d}")},
+    };
+    QCOMPARE(QMStyleSheetTemplate::fromVariables(stylesheet).bind(variables),
+             QMSimpleVarExp::evaluate(stylesheet, variables, QStringLiteral(R"([^\}]+)")));
+}
+
+void tst_StyleSheet::bindCycles() {
+    const QHash<QString, QString> variables{
+        {QStringLiteral("a"), QStringLiteral("${b}px")},
+        {QStringLiteral("b"), QStringLiteral("${a}")},
+        {QStringLiteral("c"), QStringLiteral("${c}")},
+        {QStringLiteral("d"), QStringLiteral("${e}")},
+        {QStringLiteral("e"), QStringLiteral("1")},
+    };
+
+    const auto &table = QMVariableTable::resolve(variables);
+    QCOMPARE(table.cycles.size(), 2);
+    QVERIFY(table.cycles.contains(QStringLiteral("c -> c")));
+    QVERIFY(table.cycles.contains(QStringLiteral("a -> b -> a")) ||
+            table.cycles.contains(QStringLiteral("b -> a -> b")));
+
+    // The reference that closes a cycle is replaced by the name
+    QCOMPARE(table.values.value(QStringLiteral("c")), QStringLiteral("c"));
+    QCOMPARE(table.values.value(QStringLiteral("d")), QStringLiteral("1"));
+
+    const auto &tpl = QMStyleSheetTemplate::fromVariables(QStringLiteral("${c} ${d} $${e}"));
+    QCOMPARE(tpl.bind(table), QStringLiteral("c 1 ${e}"));
+}
+
+QTEST_APPLESS_MAIN(tst_StyleSheet)
+
+#include "tst_stylesheet.moc"
@@ -0,0 +1,330 @@
+#include <QApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QWidget>
+#include <QtTest>
+
+#include <QMWidgets/qmdecoratorv2.h>
+#include <QMWidgets/private/qmthemebundle_p.h>
+#include <QMWidgets/private/qmthemecache_p.h>
+
+static bool writeFile(const QString &fileName, const QByteArray &data) {
+    if (!QDir().mkpath(QFileInfo(fileName).absolutePath())) {
+        return false;
+    }
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    return file.write(data) == data.size();
+}
+
+// Writes a package that defines the variable "color" of the themes "Light" and "Dark", and a
+// style sheet file of the namespace "ns" for each theme, which is mapped to the widget id "W"
+static bool writePackage(const QString &dir, const QString &lightColor, const QString &darkColor) {
+    const QPair<QString, QString> themes[] = {
+        {QStringLiteral("Light"), lightColor},
+        {QStringLiteral("Dark"), darkColor},
+    };
+
+    QJsonObject variables;
+    QJsonObject stylesheets;
+    for (const auto &theme : themes) {
+        const QString fileName = theme.first.toLower() + QStringLiteral(".qss");
+        if (!writeFile(QDir(dir).filePath(fileName), "QWidget { color: ${color}; }")) {
+            return false;
+        }
+        variables.insert(theme.first, QJsonObject{{QStringLiteral("color"), theme.second}});
+        stylesheets.insert(theme.first,
+                           QJsonObject{{QStringLiteral("ns"),
+                                        QJsonObject{{QStringLiteral("file"), fileName}}}});
+    }
+
+    QJsonObject root;
+    root.insert(QStringLiteral("variables"), variables);
+    root.insert(QStringLiteral("widgets"),
+                QJsonObject{{QStringLiteral("W"), QStringLiteral("ns")}});
+    root.insert(QStringLiteral("stylesheets"), stylesheets);
+    return writeFile(QDir(dir).filePath(QStringLiteral("package.res.json")),
+                     QJsonDocument(root).toJson());
+}
+
+class tst_Theme : public QObject {
+    Q_OBJECT
+private Q_SLOTS:
+    void cacheFormat();
+    void cacheInvalidation();
+    void incrementalPaths();
+    void bundleLookup();
+    void lazyLoading();
+};
+
+void tst_Theme::cacheFormat() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("themes"));
+    QVERIFY(writePackage(path, QStringLiteral("#aa0000"), QStringLiteral("#00aa00")));
+
+    const QFileInfoList files = QMThemePackage::searchFiles(path);
+    QCOMPARE(files.size(), 1);
+
+    QMThemeCache cache;
+    cache.path = path;
+    cache.sources.append(QMThemeFileStamp::fromFileInfo(files.first()));
+
+    QMThemePackage package;
+    QVERIFY(package.load(files.first().absoluteFilePath()));
+    for (const auto &item : package.items()) {
+        item->readStyleSheet();
+        QVERIFY(item->loaded);
+    }
+    cache.packages.append(package);
+
+    const QString cacheFile = QMThemeCache::cacheFileName(dir.filePath(QStringLiteral("cache")),
+                                                          path);
+    QVERIFY(cache.save(cacheFile));
+
+    QMThemeCache loaded;
+    QVERIFY(loaded.load(cacheFile));
+    QCOMPARE(loaded.path, cache.path);
+    QCOMPARE(loaded.sources.size(), 1);
+    QVERIFY(loaded.sources.first() == cache.sources.first());
+    QCOMPARE(loaded.packages.size(), 1);
+
+    auto &loadedPackage = loaded.packages.first();
+    QCOMPARE(loadedPackage.fileName, package.fileName);
+    QCOMPARE(loadedPackage.variables.size(), package.variables.size());
+    QVERIFY(loadedPackage.nsMappings == package.nsMappings);
+
+    const auto &items = package.items();
+    const auto &loadedItems = loadedPackage.items();
+    QCOMPARE(loadedItems.size(), items.size());
+    for (int i = 0; i < items.size(); ++i) {
+        QCOMPARE(loadedItems.at(i)->fileName, items.at(i)->fileName);
+        QCOMPARE(loadedItems.at(i)->loaded, items.at(i)->loaded);
+        QCOMPARE(loadedItems.at(i)->result, items.at(i)->result);
+        QVERIFY(loadedItems.at(i)->stamp == items.at(i)->stamp);
+    }
+    QVERIFY(loaded.isUpToDate(path, files));
+    QVERIFY(!loaded.isUpToDate(dir.filePath(QStringLiteral("other")), files));
+
+    // A changed style sheet makes the cache out of date
+    QVERIFY(writeFile(QDir(path).filePath(QStringLiteral("light.qss")),
+                      "QWidget { background-color: ${color}; }"));
+    QVERIFY(!loaded.isUpToDate(path, files));
+
+    // So does a truncated file
+    QFile file(cacheFile);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() / 2));
+    file.close();
+    QVERIFY(!QMThemeCache().load(cacheFile));
+}
+
+void tst_Theme::cacheInvalidation() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("themes"));
+    const QString cacheDir = dir.filePath(QStringLiteral("cache"));
+    QVERIFY(writePackage(path, QStringLiteral("#aa0000"), QStringLiteral("#00aa00")));
+
+    auto scan = [&]() {
+        QMDecoratorV2 dec;
+        dec.setThemeCacheDirectory(cacheDir);
+        dec.addThemePath(path);
+        dec.themes();
+        return dec.lastScanStatistics();
+    };
+
+    auto stats = scan();
+    QCOMPARE(stats.pathCount, 1);
+    QCOMPARE(stats.cachedPathCount, 0);
+    QCOMPARE(stats.fileCount, 1);
+    QVERIFY(QFileInfo::exists(QMThemeCache::cacheFileName(cacheDir, path)));
+
+    stats = scan();
+    QCOMPARE(stats.cachedPathCount, 1);
+    QCOMPARE(stats.fileCount, 0);
+
+    // The package file changes, the sizes differ in case the modify times are the same
+    QVERIFY(writePackage(path, QStringLiteral("#80bb0000"), QStringLiteral("#00aa00")));
+    stats = scan();
+    QCOMPARE(stats.cachedPathCount, 0);
+    QCOMPARE(stats.fileCount, 1);
+
+    stats = scan();
+    QCOMPARE(stats.cachedPathCount, 1);
+
+    // The style sheets are read into the cache, so they're checked as well
+    QVERIFY(writeFile(QDir(path).filePath(QStringLiteral("dark.qss")),
+                      "QWidget { background-color: ${color}; }"));
+    stats = scan();
+    QCOMPARE(stats.cachedPathCount, 0);
+
+    stats = scan();
+    QCOMPARE(stats.cachedPathCount, 1);
+
+    // A package is added
+    QVERIFY(writePackage(QDir(path).filePath(QStringLiteral("sub")), QStringLiteral("#cc0000"),
+                         QStringLiteral("#00cc00")));
+    stats = scan();
+    QCOMPARE(stats.cachedPathCount, 0);
+    QCOMPARE(stats.fileCount, 2);
+}
+
+void tst_Theme::incrementalPaths() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString pathA = dir.filePath(QStringLiteral("a"));
+    const QString pathB = dir.filePath(QStringLiteral("b"));
+    QVERIFY(writePackage(pathA, QStringLiteral("#aa0000"), QStringLiteral("#00aa00")));
+    QVERIFY(writePackage(pathB, QStringLiteral("#bb0000"), QStringLiteral("#00bb00")));
+
+    QMDecoratorV2 dec;
+    dec.addThemePath(pathA);
+
+    // The paths are scanned incrementally while there are subscribers
+    QWidget w;
+    dec.installTheme(&w, QStringLiteral("W"));
+    dec.setTheme(QStringLiteral("Light"));
+    QCOMPARE(dec.lastScanStatistics().pathCount, 1);
+    QCOMPARE(dec.themeVariable(QStringLiteral("color")), QStringLiteral("#aa0000"));
+
+    // The paths added earlier take precedence
+    dec.addThemePath(pathB);
+    QCOMPARE(dec.lastScanStatistics().pathCount, 1);
+    QCOMPARE(dec.themeVariable(QStringLiteral("color")), QStringLiteral("#aa0000"));
+
+    dec.removeThemePath(pathA);
+    QCOMPARE(dec.lastScanStatistics().pathCount, 0);
+    QCOMPARE(dec.themeVariable(QStringLiteral("color")), QStringLiteral("#bb0000"));
+
+    dec.addThemePath(pathA);
+    QCOMPARE(dec.lastScanStatistics().pathCount, 1);
+    QCOMPARE(dec.themeVariable(QStringLiteral("color")), QStringLiteral("#bb0000"));
+
+    dec.setTheme(QStringLiteral("Dark"));
+    QCOMPARE(dec.themeVariable(QStringLiteral("color")), QStringLiteral("#00bb00"));
+}
+
+void tst_Theme::bundleLookup() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString source = dir.filePath(QStringLiteral("source"));
+    QVERIFY(writePackage(source, QStringLiteral("#aa0000"), QStringLiteral("#00aa00")));
+    QVERIFY(writeFile(QDir(source).filePath(QStringLiteral("images/arrow.png")), "arrow"));
+
+    const QString bundleDir = dir.filePath(QStringLiteral("bundles"));
+    QVERIFY(QMThemeBundle::pack(source, QDir(bundleDir).filePath(QStringLiteral("theme.qmtb"))));
+
+    // The bundle is added through a symbolic link of its directory
+    const QString linkDir = dir.filePath(QStringLiteral("link"));
+    if (!QFile::link(bundleDir, linkDir)) {
+        QSKIP("symbolic links are not supported");
+    }
+    const QString bundle = QDir(linkDir).filePath(QStringLiteral("theme.qmtb"));
+
+    QMDecoratorV2 dec;
+    dec.addThemePath(bundle);
+    QStringList themes = dec.themes();
+    themes.sort();
+    QCOMPARE(themes, QStringList({QStringLiteral("Dark"), QStringLiteral("Light")}));
+    dec.setTheme(QStringLiteral("Light"));
+    QCOMPARE(dec.themeVariable(QStringLiteral("color")), QStringLiteral("#aa0000"));
+
+    // The entries are found by the path of the link, the canonical path and a relative path
+    QString name;
+    const auto opened = QMThemeBundle::find(QDir(bundle).filePath(QStringLiteral("light.qss")),
+                                            &name);
+    QVERIFY(opened);
+    QCOMPARE(name, QStringLiteral("light.qss"));
+    QCOMPARE(opened->entryData(name), QByteArray("QWidget { color: ${color}; }"));
+
+    const QString canonicalPath = QFileInfo(bundle).canonicalFilePath();
+    QVERIFY(QMThemeBundle::find(canonicalPath + QStringLiteral("/images/arrow.png"), &name) ==
+            opened);
+    QCOMPARE(name, QStringLiteral("images/arrow.png"));
+
+    const QString currentPath = QDir::currentPath();
+    QVERIFY(QDir::setCurrent(dir.path()));
+    const auto found = QMThemeBundle::find(QStringLiteral("link/theme.qmtb/dark.qss"), &name);
+    QVERIFY(QDir::setCurrent(currentPath));
+    QVERIFY(found == opened);
+    QCOMPARE(name, QStringLiteral("dark.qss"));
+
+    // The images that the style sheets refer to are extracted
+    const QString stylesheet = QMPrivate::resolveBundleUrls(
+        QStringLiteral("QWidget { image: url(\"%1/images/arrow.png\"); }").arg(bundle));
+    const QString extracted = stylesheet.section(QLatin1Char('"'), 1, 1);
+    QVERIFY(!extracted.contains(QStringLiteral(".qmtb")));
+    QFile file(extracted);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), QByteArray("arrow"));
+
+    // The bundle is unmapped when no path uses it
+    dec.removeThemePath(bundle);
+    QVERIFY(dec.themes().isEmpty());
+    QVERIFY(!QMThemeBundle::find(canonicalPath + QStringLiteral("/light.qss"), nullptr));
+}
+
+void tst_Theme::lazyLoading() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(writePackage(dir.path(), QStringLiteral("#aa0000"), QStringLiteral("#00aa00")));
+
+    QMDecoratorV2 dec;
+    dec.addThemePath(dir.path());
+
+    // Only the package files are parsed until a theme is used
+    QCOMPARE(dec.themes().size(), 2);
+    QCOMPARE(dec.lastScanStatistics().fileCount, 1);
+    QCOMPARE(dec.lastScanStatistics().styleSheetCount, 0);
+
+    QWidget w;
+    dec.installTheme(&w, QStringLiteral("W"));
+    w.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&w));
+
+    // The visible subscribers are restyled in several event loop iterations
+    QSignalSpy spy(&dec, &QMDecoratorV2::themeChanged);
+    auto setTheme = [&](const QString &theme) {
+        const int count = spy.count();
+        dec.setTheme(theme);
+        return QTest::qWaitFor([&]() { return spy.count() > count; });
+    };
+
+    QVERIFY(setTheme(QStringLiteral("Light")));
+    QCOMPARE(dec.lastScanStatistics().styleSheetCount, 1);
+    QVERIFY(w.styleSheet().contains(QStringLiteral("#aa0000")));
+
+    QVERIFY(setTheme(QStringLiteral("Dark")));
+    QCOMPARE(dec.lastScanStatistics().styleSheetCount, 2);
+    QVERIFY(w.styleSheet().contains(QStringLiteral("#00aa00")));
+
+    // The previous theme stays loaded
+    QVERIFY(setTheme(QStringLiteral("Light")));
+    QCOMPARE(dec.lastScanStatistics().styleSheetCount, 2);
+    QVERIFY(w.styleSheet().contains(QStringLiteral("#aa0000")));
+
+    // The inactive themes beyond the limit are read again when they're used
+    dec.setInactiveThemeLimit(0);
+    QVERIFY(setTheme(QStringLiteral("Dark")));
+    QCOMPARE(dec.lastScanStatistics().styleSheetCount, 3);
+    QVERIFY(w.styleSheet().contains(QStringLiteral("#00aa00")));
+}
+
+int main(int argc, char *argv[]) {
+    // Run headless unless a platform is specified
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+    tst_Theme tc;
+    return QTest::qExec(&tc, argc, argv);
+}
+
+#include "tst_theme.moc"
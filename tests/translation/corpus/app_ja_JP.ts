@@ -0,0 +1,15 @@
+<?xml version="1.0" encoding="utf-8"?>
+<!DOCTYPE TS>
+<TS version="2.1" language="ja_JP">
+<context>
+    <name>tst</name>
+    <message>
+        <source>Hello</source>
+        <translation>app-ja: Hello</translation>
+    </message>
+    <message>
+        <source>OnlyApp</source>
+        <translation>app-ja: OnlyApp</translation>
+    </message>
+</context>
+</TS>
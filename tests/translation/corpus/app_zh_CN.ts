@@ -0,0 +1,15 @@
+<?xml version="1.0" encoding="utf-8"?>
+<!DOCTYPE TS>
+<TS version="2.1" language="zh_CN">
+<context>
+    <name>tst</name>
+    <message>
+        <source>Hello</source>
+        <translation>app-zh: Hello</translation>
+    </message>
+    <message>
+        <source>OnlyApp</source>
+        <translation>app-zh: OnlyApp</translation>
+    </message>
+</context>
+</TS>
@@ -0,0 +1,473 @@
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QTranslator>
+#include <QtTest>
+
+#include <QMCore/qmcoreappextension.h>
+#include <QMCore/qmcoredecoratorv2.h>
+#include <QMCore/private/qmmergedtranslator_p.h>
+#include <QMCore/private/qmtranslationindex_p.h>
+
+// Copies the compiled corpus, the Chinese files to the directory and the Japanese file to its
+// subdirectory "sub", so that the path is searched recursively
+static bool copyCorpus(const QString &dir) {
+    const QDir qmDir(QStringLiteral(TST_QM_DIR));
+    const QPair<QString, QString> files[] = {
+        {QStringLiteral("app_zh_CN.qm"), QStringLiteral("app_zh_CN.qm")},
+        {QStringLiteral("lib_zh_CN.qm"), QStringLiteral("lib_zh_CN.qm")},
+        {QStringLiteral("app_ja_JP.qm"), QStringLiteral("sub/app_ja_JP.qm")},
+    };
+    if (!QDir(dir).mkpath(QStringLiteral("sub"))) {
+        return false;
+    }
+    for (const auto &file : files) {
+        if (!QFile::copy(qmDir.filePath(file.first), QDir(dir).filePath(file.second))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool appendFile(const QString &fileName, const QByteArray &data) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::Append)) {
+        return false;
+    }
+    return file.write(data) == data.size();
+}
+
+static QByteArray readCorpus(const QString &fileName) {
+    QFile file(QDir(QStringLiteral(TST_QM_DIR)).filePath(fileName));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    return file.readAll();
+}
+
+static inline QString translate(const char *sourceText) {
+    return QCoreApplication::translate("tst", sourceText);
+}
+
+// Starts from a locale without translations so that adding the path installs nothing
+static void addCorpusPath(QMCoreDecoratorV2 &decorator, const QString &path) {
+    decorator.setLocale(QStringLiteral("C"));
+    decorator.addTranslationPath(path);
+}
+
+// Returns the locale and whether it's applied of each finished asynchronous switch
+static QMap<QString, bool> finishedSwitches(const QSignalSpy &spy) {
+    QMap<QString, bool> res;
+    for (const auto &args : spy) {
+        res.insert(args.at(0).toString(), args.at(1).toBool());
+    }
+    return res;
+}
+
+class tst_Translation : public QObject {
+    Q_OBJECT
+public:
+    tst_Translation();
+
+private Q_SLOTS:
+    void cleanup();
+
+    void indexScan();
+    void indexCache();
+    void indexDecorator();
+
+    void setLocale();
+    void setLocaleAsync();
+    void setLocaleAsyncSuperseded();
+    void setLocaleAsyncCurrent();
+
+    void translateCache();
+
+    void mergedTranslator_data();
+    void mergedTranslator();
+    void mergedDecorator_data();
+    void mergedDecorator();
+};
+
+tst_Translation::tst_Translation() {
+}
+
+void tst_Translation::cleanup() {
+    // The decorators don't remove their translators, which are owned by the application
+    qDeleteAll(qApp->findChildren<QTranslator *>(QString(), Qt::FindDirectChildrenOnly));
+}
+
+void tst_Translation::indexScan() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    // Neither is a translation file of a locale
+    QVERIFY(appendFile(dir.filePath(QStringLiteral("readme.qm")), "readme"));
+    QVERIFY(appendFile(dir.filePath(QStringLiteral("app_zh_CN.ts")), "source"));
+
+    const auto index = QMTranslationIndex::scan(dir.path());
+    QCOMPARE(index.path, dir.path());
+    QCOMPARE(index.files.keys(), QStringList({QStringLiteral("ja_JP"), QStringLiteral("zh_CN")}));
+    QCOMPARE(index.files.value(QStringLiteral("zh_CN")),
+             QStringList({dir.filePath(QStringLiteral("app_zh_CN.qm")),
+                          dir.filePath(QStringLiteral("lib_zh_CN.qm"))}));
+    QCOMPARE(index.files.value(QStringLiteral("ja_JP")),
+             QStringList({dir.filePath(QStringLiteral("sub/app_ja_JP.qm"))}));
+    QCOMPARE(index.dirs.size(), 2);
+    QCOMPARE(index.stamps.size(), 3);
+    QVERIFY(index.isUpToDate());
+
+    // A file rewritten in place doesn't touch the directory
+    QVERIFY(appendFile(dir.filePath(QStringLiteral("lib_zh_CN.qm")), "padding"));
+    QVERIFY(!index.isUpToDate());
+    QVERIFY(QMTranslationIndex::scan(dir.path()).isUpToDate());
+
+    QVERIFY(QFile::remove(dir.filePath(QStringLiteral("sub/app_ja_JP.qm"))));
+    QVERIFY(!index.isUpToDate());
+
+    QVERIFY(!QMTranslationIndex().isUpToDate());
+}
+
+void tst_Translation::indexCache() {
+    QTemporaryDir dir;
+    QTemporaryDir cacheDir;
+    QVERIFY(dir.isValid());
+    QVERIFY(cacheDir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    const QString cacheFile = QMTranslationIndex::cacheFileName(cacheDir.path(), dir.path());
+    QVERIFY(cacheFile.startsWith(cacheDir.path()));
+    QVERIFY(cacheFile != QMTranslationIndex::cacheFileName(cacheDir.path(), cacheDir.path()));
+
+    const auto index = QMTranslationIndex::scan(dir.path());
+    QVERIFY(index.save(cacheFile));
+
+    QMTranslationIndex loaded;
+    QVERIFY(loaded.load(cacheFile));
+    QCOMPARE(loaded.path, index.path);
+    QCOMPARE(loaded.files, index.files);
+    QCOMPARE(loaded.dirs.size(), index.dirs.size());
+    QCOMPARE(loaded.stamps.size(), index.stamps.size());
+    QVERIFY(loaded.isUpToDate());
+
+    QVERIFY(appendFile(dir.filePath(QStringLiteral("app_zh_CN.qm")), "padding"));
+    QVERIFY(!loaded.isUpToDate());
+
+    // A damaged cache is rejected and leaves the index untouched
+    QFile file(cacheFile);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QVERIFY(file.write("damaged") > 0);
+    file.close();
+    QVERIFY(!loaded.load(cacheFile));
+    QCOMPARE(loaded.path, index.path);
+
+    QVERIFY(!loaded.load(cacheDir.filePath(QStringLiteral("missing.qmti"))));
+}
+
+void tst_Translation::indexDecorator() {
+    QTemporaryDir dir;
+    QTemporaryDir cacheDir;
+    QVERIFY(dir.isValid());
+    QVERIFY(cacheDir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    const QStringList allLocales = {QStringLiteral("ja_JP"), QStringLiteral("zh_CN")};
+    const QString cacheFile = QMTranslationIndex::cacheFileName(cacheDir.path(), dir.path());
+    {
+        QMCoreDecoratorV2 decorator;
+        decorator.setTranslationCacheDirectory(cacheDir.path());
+        QCOMPARE(decorator.translationCacheDirectory(), cacheDir.path());
+        decorator.addTranslationPath(dir.path());
+        QCOMPARE(decorator.locales(), allLocales);
+        QVERIFY(QFile::exists(cacheFile));
+    }
+
+    // Drop a locale from the cached index, which is still up to date, to see that it's used
+    QMTranslationIndex index;
+    QVERIFY(index.load(cacheFile));
+    index.files.remove(QStringLiteral("ja_JP"));
+    QVERIFY(index.save(cacheFile));
+    {
+        QMCoreDecoratorV2 decorator;
+        decorator.setTranslationCacheDirectory(cacheDir.path());
+        decorator.addTranslationPath(dir.path());
+        QCOMPARE(decorator.locales(), QStringList({QStringLiteral("zh_CN")}));
+    }
+
+    // The path is scanned again once a file changes
+    QVERIFY(appendFile(dir.filePath(QStringLiteral("sub/app_ja_JP.qm")), "padding"));
+    {
+        QMCoreDecoratorV2 decorator;
+        decorator.setTranslationCacheDirectory(cacheDir.path());
+        decorator.addTranslationPath(dir.path());
+        QCOMPARE(decorator.locales(), allLocales);
+    }
+
+    // Without a cache directory nothing is written
+    QVERIFY(QFile::remove(cacheFile));
+    {
+        QMCoreDecoratorV2 decorator;
+        decorator.addTranslationPath(dir.path());
+        QCOMPARE(decorator.locales(), allLocales);
+        QVERIFY(!QFile::exists(cacheFile));
+    }
+}
+
+void tst_Translation::setLocale() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    QMCoreDecoratorV2 decorator;
+    addCorpusPath(decorator, dir.path());
+    QCOMPARE(translate("Hello"), QStringLiteral("Hello"));
+
+    QSignalSpy changed(&decorator, &QMCoreDecoratorV2::localeChanged);
+    decorator.setLocale(QStringLiteral("zh_CN"));
+    QCOMPARE(changed.count(), 1);
+    QCOMPARE(decorator.locale(), QStringLiteral("zh_CN"));
+
+    // Both files are loaded, the one installed last takes precedence
+    QCOMPARE(translate("Hello"), QStringLiteral("lib-zh: Hello"));
+    QCOMPARE(translate("OnlyApp"), QStringLiteral("app-zh: OnlyApp"));
+    QCOMPARE(translate("OnlyLib"), QStringLiteral("lib-zh: OnlyLib"));
+
+    decorator.setLocale(QStringLiteral("ja_JP"));
+    QCOMPARE(changed.count(), 2);
+    QCOMPARE(translate("Hello"), QStringLiteral("app-ja: Hello"));
+    QCOMPARE(translate("OnlyLib"), QStringLiteral("OnlyLib"));
+
+    // Nothing happens if the locale doesn't change
+    decorator.setLocale(QStringLiteral("ja_JP"));
+    QCOMPARE(changed.count(), 2);
+}
+
+void tst_Translation::setLocaleAsync() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    QMCoreDecoratorV2 decorator;
+    addCorpusPath(decorator, dir.path());
+
+    QSignalSpy changed(&decorator, &QMCoreDecoratorV2::localeChanged);
+    QSignalSpy finished(&decorator, &QMCoreDecoratorV2::localeSwitchFinished);
+    decorator.setLocaleAsync(QStringLiteral("zh_CN"));
+
+    // The switch is applied on the event loop, the original translations stay in use meanwhile
+    QCOMPARE(decorator.locale(), QStringLiteral("C"));
+    QCOMPARE(translate("Hello"), QStringLiteral("Hello"));
+
+    QVERIFY(finished.wait());
+    QCOMPARE(finished.count(), 1);
+    QCOMPARE(finishedSwitches(finished), (QMap<QString, bool>{{QStringLiteral("zh_CN"), true}}));
+    QCOMPARE(changed.count(), 1);
+    QCOMPARE(decorator.locale(), QStringLiteral("zh_CN"));
+    QCOMPARE(translate("Hello"), QStringLiteral("lib-zh: Hello"));
+    QCOMPARE(translate("OnlyApp"), QStringLiteral("app-zh: OnlyApp"));
+}
+
+void tst_Translation::setLocaleAsyncSuperseded() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    QMCoreDecoratorV2 decorator;
+    addCorpusPath(decorator, dir.path());
+
+    QSignalSpy changed(&decorator, &QMCoreDecoratorV2::localeChanged);
+    QSignalSpy finished(&decorator, &QMCoreDecoratorV2::localeSwitchFinished);
+
+    // The files may be read in any order, only the last request is applied
+    decorator.setLocaleAsync(QStringLiteral("zh_CN"));
+    decorator.setLocaleAsync(QStringLiteral("ja_JP"));
+    QTRY_COMPARE(finished.count(), 2);
+    QCOMPARE(finishedSwitches(finished), (QMap<QString, bool>{
+                                              {QStringLiteral("ja_JP"), true},
+                                              {QStringLiteral("zh_CN"), false},
+                                          }));
+    QCOMPARE(changed.count(), 1);
+    QCOMPARE(decorator.locale(), QStringLiteral("ja_JP"));
+    QCOMPARE(translate("Hello"), QStringLiteral("app-ja: Hello"));
+
+    // A synchronous switch discards the pending one as well
+    finished.clear();
+    decorator.setLocaleAsync(QStringLiteral("zh_CN"));
+    decorator.setLocale(QStringLiteral("C"));
+    QCOMPARE(decorator.locale(), QStringLiteral("C"));
+    QTRY_COMPARE(finished.count(), 1);
+    QCOMPARE(finishedSwitches(finished), (QMap<QString, bool>{{QStringLiteral("zh_CN"), false}}));
+    QCOMPARE(changed.count(), 2);
+    QCOMPARE(decorator.locale(), QStringLiteral("C"));
+    QCOMPARE(translate("Hello"), QStringLiteral("Hello"));
+}
+
+void tst_Translation::setLocaleAsyncCurrent() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    QMCoreDecoratorV2 decorator;
+    addCorpusPath(decorator, dir.path());
+    decorator.setLocale(QStringLiteral("ja_JP"));
+
+    QSignalSpy changed(&decorator, &QMCoreDecoratorV2::localeChanged);
+    QSignalSpy finished(&decorator, &QMCoreDecoratorV2::localeSwitchFinished);
+
+    // Reported on the event loop like any other switch, without reloading the translations
+    decorator.setLocaleAsync(QStringLiteral("ja_JP"));
+    QCOMPARE(finished.count(), 0);
+    QVERIFY(finished.wait());
+    QCOMPARE(finishedSwitches(finished), (QMap<QString, bool>{{QStringLiteral("ja_JP"), true}}));
+    QCOMPARE(changed.count(), 0);
+    QCOMPARE(translate("Hello"), QStringLiteral("app-ja: Hello"));
+}
+
+void tst_Translation::translateCache() {
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    const auto cachedTranslate = [](const char *sourceText, bool *ok = nullptr) {
+        return QMCoreAppExtension::translate("tst", sourceText, nullptr, -1, ok);
+    };
+
+    QMCoreAppExtension ext;
+    auto decorator = QMCoreDecoratorV2::instance();
+    QVERIFY(decorator);
+    addCorpusPath(*decorator, dir.path());
+
+    // The missing messages are cached as well
+    bool ok = true;
+    QCOMPARE(cachedTranslate("Hello", &ok), QStringLiteral("Hello"));
+    QVERIFY(!ok);
+
+    decorator->setLocale(QStringLiteral("zh_CN"));
+    QCOMPARE(cachedTranslate("Hello", &ok), QStringLiteral("lib-zh: Hello"));
+    QVERIFY(ok);
+    QCOMPARE(cachedTranslate("Hello", &ok), QStringLiteral("lib-zh: Hello"));
+    QVERIFY(ok);
+    QCOMPARE(cachedTranslate("OnlyApp"), QStringLiteral("app-zh: OnlyApp"));
+
+    QSignalSpy finished(decorator, &QMCoreDecoratorV2::localeSwitchFinished);
+    decorator->setLocaleAsync(QStringLiteral("ja_JP"));
+    QCOMPARE(cachedTranslate("Hello"), QStringLiteral("lib-zh: Hello"));
+    QVERIFY(finished.wait());
+    QCOMPARE(cachedTranslate("Hello"), QStringLiteral("app-ja: Hello"));
+    QCOMPARE(cachedTranslate("OnlyApp"), QStringLiteral("app-ja: OnlyApp"));
+    QCOMPARE(cachedTranslate("OnlyLib", &ok), QStringLiteral("OnlyLib"));
+    QVERIFY(!ok);
+
+    // The translators installed or removed directly are seen at once
+    QTranslator translator;
+    QVERIFY(translator.load(QStringLiteral("lib_zh_CN.qm"), QStringLiteral(TST_QM_DIR)));
+    QVERIFY(qApp->installTranslator(&translator));
+    QCOMPARE(cachedTranslate("Hello"), QStringLiteral("lib-zh: Hello"));
+    QCOMPARE(cachedTranslate("OnlyLib"), QStringLiteral("lib-zh: OnlyLib"));
+
+    // An installed translator that's reloaded isn't seen until the cache is cleared
+    QVERIFY(translator.load(QStringLiteral("app_zh_CN.qm"), QStringLiteral(TST_QM_DIR)));
+    QCOMPARE(cachedTranslate("OnlyLib"), QStringLiteral("lib-zh: OnlyLib"));
+    QMCoreAppExtension::clearTranslationCache();
+    QCOMPARE(cachedTranslate("OnlyLib"), QStringLiteral("OnlyLib"));
+    QCOMPARE(cachedTranslate("Hello"), QStringLiteral("app-zh: Hello"));
+
+    QVERIFY(qApp->removeTranslator(&translator));
+    QCOMPARE(cachedTranslate("Hello"), QStringLiteral("app-ja: Hello"));
+    QCOMPARE(cachedTranslate("OnlyApp"), QStringLiteral("app-ja: OnlyApp"));
+}
+
+void tst_Translation::mergedTranslator_data() {
+    QTest::addColumn<bool>("indexed");
+
+    QTest::newRow("indexed") << true;
+    QTest::newRow("unindexed") << false;
+}
+
+void tst_Translation::mergedTranslator() {
+    QFETCH(bool, indexed);
+
+    const QByteArray appData = readCorpus(QStringLiteral("app_zh_CN.qm"));
+    const QByteArray libData = readCorpus(QStringLiteral("lib_zh_CN.qm"));
+    QVERIFY(!appData.isEmpty());
+    QVERIFY(!libData.isEmpty());
+
+    auto app = new QTranslator();
+    auto lib = new QTranslator();
+    QVERIFY(app->load(reinterpret_cast<const uchar *>(appData.constData()), appData.size()));
+    QVERIFY(lib->load(reinterpret_cast<const uchar *>(libData.constData()), libData.size()));
+
+    // Without the catalogs, every translator is looked up for every message
+    const QList<QByteArray> catalogs =
+        indexed ? QList<QByteArray>({libData, appData}) : QList<QByteArray>();
+    QMMergedTranslator merged({lib, app}, catalogs);
+    QCOMPARE(app->parent(), &merged);
+    QCOMPARE(lib->parent(), &merged);
+    QVERIFY(!merged.isEmpty());
+    QVERIFY(QMMergedTranslator(QList<QTranslator *>(), QList<QByteArray>()).isEmpty());
+
+    // The first translator takes precedence, the others fill in the missing messages
+    QCOMPARE(merged.translate("tst", "Hello"), QStringLiteral("lib-zh: Hello"));
+    QCOMPARE(merged.translate("tst", "OnlyApp"), QStringLiteral("app-zh: OnlyApp"));
+    QCOMPARE(merged.translate("tst", "OnlyLib"), QStringLiteral("lib-zh: OnlyLib"));
+    QVERIFY(merged.translate("tst", "Missing").isNull());
+    QVERIFY(merged.translate("other", "Hello").isNull());
+
+    // The same as looking up the translators in turn, including the fallback without the
+    // disambiguation
+    const char *sourceTexts[] = {"Hello", "OnlyApp", "OnlyLib", "Missing"};
+    const char *disambiguations[] = {nullptr, "disambiguation"};
+    for (const auto &sourceText : sourceTexts) {
+        for (const auto &disambiguation : disambiguations) {
+            QString expected = lib->translate("tst", sourceText, disambiguation);
+            if (expected.isNull()) {
+                expected = app->translate("tst", sourceText, disambiguation);
+            }
+            QCOMPARE(merged.translate("tst", sourceText, disambiguation), expected);
+        }
+    }
+}
+
+void tst_Translation::mergedDecorator_data() {
+    QTest::addColumn<bool>("merge");
+    QTest::addColumn<int>("translatorCount");
+
+    QTest::newRow("separate") << false << 2;
+    QTest::newRow("merged") << true << 1;
+}
+
+void tst_Translation::mergedDecorator() {
+    QFETCH(bool, merge);
+    QFETCH(int, translatorCount);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QVERIFY(copyCorpus(dir.path()));
+
+    QMCoreDecoratorV2 decorator;
+    decorator.setTranslationMergeEnabled(merge);
+    QCOMPARE(decorator.isTranslationMergeEnabled(), merge);
+    addCorpusPath(decorator, dir.path());
+
+    // The translations are the same as when the files are installed separately
+    decorator.setLocale(QStringLiteral("zh_CN"));
+    QCOMPARE(qApp->findChildren<QTranslator *>(QString(), Qt::FindDirectChildrenOnly).size(),
+             translatorCount);
+    QCOMPARE(translate("Hello"), QStringLiteral("lib-zh: Hello"));
+    QCOMPARE(translate("OnlyApp"), QStringLiteral("app-zh: OnlyApp"));
+    QCOMPARE(translate("OnlyLib"), QStringLiteral("lib-zh: OnlyLib"));
+    QCOMPARE(translate("Missing"), QStringLiteral("Missing"));
+
+    // A single file isn't merged
+    decorator.setLocale(QStringLiteral("ja_JP"));
+    QCOMPARE(qApp->findChildren<QTranslator *>(QString(), Qt::FindDirectChildrenOnly).size(), 1);
+    QCOMPARE(translate("Hello"), QStringLiteral("app-ja: Hello"));
+    QCOMPARE(translate("OnlyLib"), QStringLiteral("OnlyLib"));
+}
+
+QTEST_GUILESS_MAIN(tst_Translation)
+
+#include "tst_translation.moc"